@@ -0,0 +1,709 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Benchmarks of the hot paths of selec.
+ * Usage: bench [ingest|match|keys|index|sets|rank|fold|fields|spans] [MiB] [threads]
+ */
+
+#ifndef _DEFAULT_SOURCE
+	#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "corpus.h"
+#include "match.h"
+#include "set.h"
+
+#define REPEAT 5
+
+/* Rows of matches on screen */
+#define ROWS 40
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Something that resembles output of find(1) */
+static char *gen_corpus(size_t size, size_t *len)
+{
+	static const char *dir[] = {
+		"usr", "share", "doc", "lib", "src", "include", "local",
+		"home", "user", "Projects", "selec", "build", "node_modules",
+	};
+	static const char *ext[] = { ".c", ".h", ".txt", ".md", ".json", "" };
+	char *buf, *b;
+	unsigned r = 1;
+	int i, d;
+
+	if (!(b = buf = malloc(size + 256))) {
+		return 0;
+	}
+	while ((size_t)(b - buf) < size) {
+		d = 1 + (r = r * 1103515245 + 12345) % 7;
+		for (i = 0; i < d; i++) {
+			r = r * 1103515245 + 12345;
+			b += sprintf(b, "/%s", dir[(r >> 16) % (sizeof(dir)/sizeof(dir[0]))]);
+		}
+		r = r * 1103515245 + 12345;
+		b += sprintf(b, "/file%u%s\n", (r >> 8) % 100000,
+			ext[(r >> 20) % (sizeof(ext)/sizeof(ext[0]))]);
+	}
+	*len = b - buf;
+	return buf;
+}
+
+static void report(const char *what, size_t bytes, double t)
+{
+	printf("  %-12s %8.3f ms %8.2f GB/s\n", what, t * 1e3, bytes / t / 1e9);
+}
+
+static int bench_ingest(size_t mib)
+{
+	char tmp[] = "/tmp/selec-bench-XXXXXX";
+	char *buf, *s, *e;
+	size_t len, lines = 0;
+	double t, best;
+	int fd, r, n = 0;
+	corpus C;
+	reader R;
+
+	if (!(buf = gen_corpus(mib << 20, &len))) {
+		return 1;
+	}
+	if (-1 == (fd = mkstemp(tmp)) || (ssize_t)len != write(fd, buf, len)) {
+		perror("bench");
+		return 1;
+	}
+	unlink(tmp);
+	for (s = buf; (s = memchr(s, '\n', buf+len-s)); s++) {
+		lines++;
+	}
+	printf("ingest: %zu bytes, %zu lines\n", len, lines);
+
+	for (best = 1e9, r = 0; r < REPEAT; r++) {
+		t = now();
+		for (s = buf, e = buf+len, n = 0; (s = find_delim(s, e, '\n')); s++) {
+			n++;
+		}
+		if ((t = now() - t) < best) best = t;
+	}
+	report("find_delim", len, best);
+	if ((size_t)n != lines) return 1;
+
+	for (best = 1e9, r = 0; r < REPEAT; r++) {
+		t = now();
+		for (s = buf, e = buf+len, n = 0; (s = memchr(s, '\n', e-s)); s++) {
+			n++;
+		}
+		if ((t = now() - t) < best) best = t;
+	}
+	report("memchr", len, best);
+	if ((size_t)n != lines) return 1;
+
+	for (best = 1e9, r = 0; r < REPEAT; r++) {
+		lseek(fd, 0, SEEK_SET);
+		corpus_init(&C);
+		reader_init(&R, fd, '\n');
+		t = now();
+		while (!R.eof) {
+			if (read_entries(&R, &C, -1) == -1 && !R.eof) return 1;
+		}
+		if ((t = now() - t) < best) best = t;
+		n = C.num;
+		reader_free(&R);
+		corpus_free(&C);
+	}
+	report("read", len, best);
+	if ((size_t)n != lines) return 1;
+
+	for (best = 1e9, r = 0; r < REPEAT; r++) {
+		corpus_init(&C);
+		t = now();
+		n = corpus_map(&C, fd, '\n');
+		if ((t = now() - t) < best) best = t;
+		corpus_free(&C);
+	}
+	report("mmap", len, best);
+
+	close(fd);
+	free(buf);
+	return (size_t)n != lines;
+}
+
+/* Maps generated corpus of given size, with folded copy if fold */
+static int map_corpus(corpus *C, size_t mib, _Bool fold)
+{
+	char tmp[] = "/tmp/selec-bench-XXXXXX";
+	char *buf;
+	size_t len;
+	int fd;
+
+	if (!(buf = gen_corpus(mib << 20, &len))) {
+		return -1;
+	}
+	if (-1 == (fd = mkstemp(tmp)) || (ssize_t)len != write(fd, buf, len)) {
+		perror("bench");
+		return -1;
+	}
+	unlink(tmp);
+	free(buf);
+	corpus_init(C);
+	C->fold = fold;
+	if (corpus_map(C, fd, '\n') < 0) {
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static int bench_match(size_t mib, int threads)
+{
+	static const struct {
+		char *q;
+		int cflags;
+	} query[] = {
+		{ "file1234", REG_ICASE | REG_NEWLINE },
+		{ "doc.*json$", REG_ICASE | REG_NEWLINE },
+		{ "src/.*file12[0-9]*\\.c$", REG_ICASE | REG_NEWLINE },
+		{ "modules\\.json", REG_ICASE | REG_NEWLINE },
+		{ "", REG_ICASE | REG_NEWLINE },
+		{ "shdoc12json", REG_ICASE | REG_NEWLINE | M_FUZZY },
+		{ "^/usr json$ !node", REG_ICASE | REG_NEWLINE | M_EXTENDED },
+		{ "src | lib file12 !\\.h$", REG_ICASE | REG_NEWLINE | M_EXTENDED },
+		{ "shdoc 'json !node", REG_ICASE | REG_NEWLINE | M_FUZZY | M_EXTENDED },
+	};
+	mlist L;
+	double t, best, one = 0;
+	mstats st;
+	int q, r, n, T;
+	corpus C;
+	matcher M;
+
+	if (map_corpus(&C, mib, 0)) {
+		return 1;
+	}
+	printf("match: %d lines\n", C.num);
+	for (q = 0; q < (int)(sizeof(query)/sizeof(query[0])); q++) {
+		printf("  %s%s \"%s\"\n", query[q].cflags & M_EXTENDED ? "extended " : "",
+			query[q].cflags & M_FUZZY ? "fuzzy" : "regex", query[q].q);
+		for (T = 1; T <= threads; T = T < threads && 2*T > threads ? threads : 2*T) {
+			if (matcher_init(&M, T)) {
+				return 1;
+			}
+			matcher_compile(&M, query[q].q, query[q].cflags);
+			for (best = 1e9, r = 0; r < REPEAT; r++) {
+				mlist_init(&L);
+				t = now();
+				n = entry_match(&M, &C, 0, C.num, &L);
+				entry_rank(&M, &L, ROWS);
+				if ((t = now() - t) < best) best = t;
+				mlist_free(&L);
+			}
+			if (T == 1) one = best;
+			printf("  %3d threads %8.3f ms %6.2fx %d matches\n",
+				M.P.threads, best * 1e3, one / best, n);
+			matcher_stats(&M, &st);
+			if (T == 1 && (st.skipped || st.masked || st.filtered)) {
+				printf("  of %zu skipped %zu in blocks, rejected %zu by mask, %zu by literals\n",
+					st.tested / REPEAT, st.skipped / REPEAT, st.masked / REPEAT,
+					st.filtered / REPEAT);
+			}
+			matcher_free(&M);
+		}
+	}
+	corpus_free(&C);
+	return 0;
+}
+
+/*
+ * Types a query one key at a time and matches whole corpus after each key,
+ * as plain literal and as the same text in regex form
+ * (last character in brackets).
+ */
+static int bench_keys(size_t mib, int threads)
+{
+	static const char *typed = "node_modules";
+	char q[64], rq[64];
+	mlist L;
+	double t[2], sum[2] = {0, 0};
+	int k, i, n[2];
+	corpus C;
+	matcher M;
+
+	if (map_corpus(&C, mib, 0) || matcher_init(&M, threads)) {
+		return 1;
+	}
+	printf("keys: %d lines, %d threads\n", C.num, M.P.threads);
+	printf("  %-14s %10s %10s\n", "query", "literal", "regex");
+	for (k = 1; typed[k-1]; k++) {
+		memcpy(q, typed, k);
+		q[k] = 0;
+		memcpy(rq, typed, k-1);
+		sprintf(rq+k-1, "[%c]", typed[k-1]);
+		for (i = 0; i < 2; i++) {
+			matcher_compile(&M, i ? rq : q, REG_ICASE | REG_NEWLINE);
+			mlist_init(&L);
+			t[i] = now();
+			n[i] = entry_match(&M, &C, 0, C.num, &L);
+			entry_rank(&M, &L, ROWS);
+			sum[i] += t[i] = now() - t[i];
+			mlist_free(&L);
+		}
+		printf("  %-14s %7.3f ms %7.3f ms %d matches\n", q, t[0] * 1e3, t[1] * 1e3, n[0]);
+		if (n[0] != n[1]) {
+			return 1;
+		}
+	}
+	printf("  %-14s %7.3f ms %7.3f ms\n", "mean", sum[0] * 1e3 / (k-1),
+		sum[1] * 1e3 / (k-1));
+	matcher_free(&M);
+	corpus_free(&C);
+	return 0;
+}
+
+/* Builds the trigram index and matches queries with and without it */
+static int bench_index(size_t mib, int threads)
+{
+	static const char *query[] = {
+		"file1234", "node_modules", "doc.*json$", "src/.*file12[0-9]*\\.c$",
+		"lib/x", "e",
+	};
+	mlist L;
+	double t[2], s;
+	int q, i, r, n[2];
+	corpus C;
+	matcher M;
+	tindex I;
+	mstats st;
+
+	if (map_corpus(&C, mib, 0) || matcher_init(&M, threads)) {
+		return 1;
+	}
+	index_init(&I);
+	t[0] = now();
+	if (index_start(&I, &C, (size_t)-1)) {
+		return 1;
+	}
+	while (!I.joined) {
+		index_ready(&I);
+		usleep(1000);
+	}
+	if (!index_ready(&I)) {
+		printf("index: failed\n");
+		return 1;
+	}
+	printf("index: %d lines, %zu MiB corpus, %zu MiB index, built in %.0f ms\n",
+		C.num, mib, I.size >> 20, (now() - t[0]) * 1e3);
+	printf("  %-24s %10s %10s\n", "query", "scan", "index");
+	for (q = 0; q < (int)(sizeof(query)/sizeof(query[0])); q++) {
+		for (i = 0; i < 2; i++) {
+			matcher_index(&M, i ? &I : 0);
+			for (t[i] = 1e9, r = 0; r < REPEAT; r++) {
+				matcher_compile(&M, (char*)query[q], REG_ICASE | REG_NEWLINE);
+				mlist_init(&L);
+				s = now();
+				n[i] = entry_match(&M, &C, 0, C.num, &L);
+				if ((s = now() - s) < t[i]) t[i] = s;
+				mlist_free(&L);
+			}
+		}
+		matcher_stats(&M, &st);
+		printf("  %-24s %7.3f ms %7.3f ms %d matches of %zu candidates\n",
+			query[q], t[0] * 1e3, t[1] * 1e3, n[0],
+			st.tested - st.skipped - st.indexed);
+		if (n[0] != n[1]) {
+			return 1;
+		}
+	}
+	matcher_free(&M);
+	index_free(&I);
+	corpus_free(&C);
+	return 0;
+}
+
+/*
+ * Intersects matches of two queries, as the trigram index does with its
+ * lists, checking it against the regex that means the same
+ */
+static int bench_sets(size_t mib, int threads)
+{
+	mlist A, B, AB;
+	uint32_t *S;
+	double t, best = 1e9;
+	int n = 0, r, bad;
+	corpus C;
+	matcher M;
+
+	if (map_corpus(&C, mib, 0) || matcher_init(&M, threads)) {
+		return 1;
+	}
+	mlist_init(&A);
+	mlist_init(&B);
+	mlist_init(&AB);
+	matcher_compile(&M, "doc", REG_ICASE | REG_NEWLINE);
+	entry_match(&M, &C, 0, C.num, &A);
+	matcher_compile(&M, "json", REG_ICASE | REG_NEWLINE);
+	entry_match(&M, &C, 0, C.num, &B);
+	matcher_compile(&M, "doc.*json|json.*doc", REG_ICASE | REG_NEWLINE | REG_EXTENDED);
+	entry_match(&M, &C, 0, C.num, &AB);
+	if (!(S = malloc((A.n + 1) * sizeof(uint32_t)))) {
+		return 1;
+	}
+	for (r = 0; r < REPEAT; r++) {
+		memcpy(S, A.E, A.n * sizeof(uint32_t));
+		t = now();
+		n = set_and(S, A.n, B.E, B.n);
+		if ((t = now() - t) < best) best = t;
+	}
+	printf("sets: %d lines, \"doc\" %d, \"json\" %d matches, %zu bytes each\n",
+		C.num, A.n, B.n, sizeof(uint32_t));
+	printf("  and    %7.3f ms %d\n", best * 1e3, n);
+	bad = n != AB.n;
+	free(S);
+	mlist_free(&A);
+	mlist_free(&B);
+	mlist_free(&AB);
+	matcher_free(&M);
+	corpus_free(&C);
+	return bad;
+}
+
+/*
+ * Ranks fuzzy matches: a screen of them at once, as they come in slices,
+ * and all of them, checking that the best are the same
+ */
+static int bench_rank(size_t mib, int threads)
+{
+	static const char *query[] = { "e", "sdoc", "shdoc12json" };
+	mlist L, A;
+	double t[3];
+	int q, i, s, bad = 0;
+	corpus C;
+	matcher M;
+
+	if (map_corpus(&C, mib, 0) || matcher_init(&M, threads)) {
+		return 1;
+	}
+	printf("rank: %d lines, %d threads\n", C.num, M.P.threads);
+	printf("  %-14s %10s %10s %10s\n", "query", "top", "sliced", "all");
+	for (q = 0; q < (int)(sizeof(query)/sizeof(query[0])); q++) {
+		matcher_compile(&M, (char*)query[q], REG_ICASE | REG_NEWLINE | M_FUZZY);
+		mlist_init(&L);
+		mlist_init(&A);
+		entry_match(&M, &C, 0, C.num, &L);
+		t[0] = now();
+		entry_rank(&M, &L, ROWS);
+		t[0] = now() - t[0];
+		/* As selec does after each slice of matching */
+		t[1] = 0;
+		for (s = 0; s < 16; s++) {
+			entry_match(&M, &C, s * (C.num/16), s == 15 ? C.num : (s+1) * (C.num/16), &A);
+			t[1] -= now();
+			entry_rank(&M, &A, ROWS);
+			t[1] += now();
+		}
+		t[2] = now();
+		entry_rank(&M, &L, L.n);
+		t[2] = now() - t[2];
+		for (i = 0; i < ROWS && i < L.n; i++) {
+			bad |= L.E[L.R[i]] != A.E[A.R[i]];
+		}
+		printf("  %-14s %7.3f ms %7.3f ms %7.3f ms %d matches\n", query[q],
+			t[0] * 1e3, t[1] * 1e3, t[2] * 1e3, L.n);
+		mlist_free(&L);
+		mlist_free(&A);
+	}
+	matcher_free(&M);
+	corpus_free(&C);
+	return bad;
+}
+
+/*
+ * Maps corpus without a folded copy, with a case folded one and with one
+ * also without diacritics, and matches case insensitive queries in each,
+ * checking that the matches are the same. Then folds Polish text.
+ */
+static int bench_fold(size_t mib, int threads)
+{
+	static const struct {
+		char *q;
+		int cflags;
+	} query[] = {
+		{ "file1234", REG_ICASE | REG_NEWLINE },
+		{ "modules\\.json", REG_ICASE | REG_NEWLINE },
+		{ "^/usr json$ 'share", REG_ICASE | REG_NEWLINE | M_EXTENDED },
+		{ "shdoc12json", REG_ICASE | REG_NEWLINE | M_FUZZY },
+		{ "e", REG_ICASE | REG_NEWLINE | M_FUZZY },
+	};
+	static const int how[3] = { 0, FOLD_CASE, FOLD_CASE | FOLD_MARKS };
+	static const char pl[] = "Zażółć GĘŚLĄ jaźń. ";
+	mlist L[3];
+	double t[3], best;
+	int q, f, r, i, n[3], bad = 0;
+	size_t k, len = 0;
+	char *buf, out[sizeof(pl)];
+	corpus C[3];
+	matcher M;
+
+	for (f = 0; f < 3; f++) {
+		t[f] = now();
+		if (map_corpus(&C[f], mib, how[f])) {
+			return 1;
+		}
+		t[f] = now() - t[f];
+	}
+	printf("fold: %d lines, %d threads\n", C[0].num, threads);
+	printf("  map %.3f s, case folded %.3f s, also diacritics %.3f s, copy takes %.1f MiB\n",
+		t[0], t[1], t[2], C[1].folded / 1048576.0);
+	printf("  %-20s %10s %10s %10s\n", "query", "plain", "case", "diacritics");
+	for (q = 0; q < (int)(sizeof(query)/sizeof(query[0])); q++) {
+		for (f = 0; f < 3; f++) {
+			if (matcher_init(&M, threads)) {
+				return 1;
+			}
+			matcher_fold(&M, how[f]);
+			matcher_compile(&M, query[q].q, query[q].cflags);
+			for (best = 1e9, r = 0; r < REPEAT; r++) {
+				mlist_init(&L[f]);
+				t[f] = now();
+				n[f] = entry_match(&M, &C[f], 0, C[f].num, &L[f]);
+				if ((t[f] = now() - t[f]) < best) best = t[f];
+				if (r < REPEAT - 1) mlist_free(&L[f]);
+			}
+			t[f] = best;
+			matcher_free(&M);
+		}
+		for (f = 1; f < 3; f++) {
+			bad |= n[0] != n[f];
+			for (i = 0; !bad && i < n[0]; i++) {
+				bad |= L[0].E[i] != L[f].E[i]
+					|| (L[0].S && L[0].S[i] != L[f].S[i]);
+			}
+		}
+		printf("  %-20s %7.3f ms %7.3f ms %7.3f ms %d matches%s\n", query[q].q,
+			t[0] * 1e3, t[1] * 1e3, t[2] * 1e3, n[0], bad ? " DIFFER" : "");
+		for (f = 0; f < 3; f++) {
+			mlist_free(&L[f]);
+		}
+	}
+	for (f = 0; f < 3; f++) {
+		corpus_free(&C[f]);
+	}
+	if (!(buf = malloc(mib << 20))) {
+		return 1;
+	}
+	for (k = 0; k + sizeof(pl) - 1 <= mib << 20; k += sizeof(pl) - 1) {
+		memcpy(buf + k, pl, sizeof(pl) - 1);
+	}
+	for (f = 1; f < 3; f++) {
+		t[f] = now();
+		len = str_fold(buf, buf, k, how[f]);
+		t[f] = now() - t[f];
+		report(f == 1 ? "fold case" : "diacritics", k, t[f]);
+		k = len;
+	}
+	free(buf);
+	len = str_fold(out, pl, sizeof(pl) - 1, how[2]);
+	printf("  \"%s\" folds to \"%.*s\"\n", pl, (int)len, out);
+	return bad;
+}
+
+/*
+ * Adds id<TAB>path<TAB>metadata rows to a corpus as they are read,
+ * whole and split into fields, and matches paths in both
+ */
+static int bench_fields(size_t mib, int threads)
+{
+	static const char *query[] = { "file1234", "^/usr", "shdoc12json" };
+	static const int cflags[] = {
+		REG_ICASE | REG_NEWLINE,
+		REG_ICASE | REG_NEWLINE | M_EXTENDED,
+		REG_ICASE | REG_NEWLINE | M_FUZZY,
+	};
+	char *gen, *buf, *s, *e, *nl;
+	size_t len, n = 0;
+	double t[2], best;
+	int f, q, k, r, m[2];
+	corpus C[2];
+	matcher M;
+	mlist L;
+
+	if (!(gen = gen_corpus(mib << 20, &len)) || !(buf = malloc(2*len + (mib << 20)))) {
+		return 1;
+	}
+	for (k = 0, s = gen, e = gen + len; s < e; s = nl+1, k++) {
+		nl = memchr(s, '\n', e - s);
+		n += sprintf(buf + n, "%d\t%.*s\tsize=%d\n", k, (int)(nl - s), s, k % 4096);
+	}
+	free(gen);
+	for (f = 0; f < 2; f++) {
+		corpus_init(&C[f]);
+		C[f].split = f;
+		C[f].fdelim = '\t';
+		C[f].nth[0] = C[f].nth[1] = 2;
+		C[f].show[0] = 2;
+		C[f].show[1] = -1;
+		t[f] = now();
+		for (s = buf, e = buf + n; s < e; s = nl+1) {
+			nl = memchr(s, '\n', e - s);
+			if (!corpus_add(&C[f], s, nl - s)) {
+				return 1;
+			}
+		}
+		t[f] = now() - t[f];
+	}
+	free(buf);
+	printf("fields: %d lines, %d threads\n", C[0].num, threads);
+	report("add", n, t[0]);
+	report("add, split", n, t[1]);
+	printf("  %-14s %10s %10s\n", "query", "line", "2nd field");
+	for (q = 0; q < (int)(sizeof(query)/sizeof(query[0])); q++) {
+		for (f = 0; f < 2; f++) {
+			if (matcher_init(&M, threads)) {
+				return 1;
+			}
+			matcher_compile(&M, (char*)query[q], cflags[q]);
+			for (best = 1e9, r = 0; r < REPEAT; r++) {
+				mlist_init(&L);
+				t[f] = now();
+				m[f] = entry_match(&M, &C[f], 0, C[f].num, &L);
+				if ((t[f] = now() - t[f]) < best) best = t[f];
+				mlist_free(&L);
+			}
+			t[f] = best;
+			matcher_free(&M);
+		}
+		printf("  %-14s %7.3f ms %7.3f ms %d and %d matches\n", query[q],
+			t[0] * 1e3, t[1] * 1e3, m[0], m[1]);
+	}
+	corpus_free(&C[0]);
+	corpus_free(&C[1]);
+	return 0;
+}
+
+/*
+ * Finds spans of matches of a screen of the best, as drawing does,
+ * then again from the cache, and of all matches for comparison
+ */
+static int bench_spans(size_t mib, int threads)
+{
+	static const struct {
+		char *q;
+		int cflags;
+	} query[] = {
+		{ "file12", REG_ICASE | REG_NEWLINE },
+		{ "src/.*file12[0-9]*\\.c$", REG_ICASE | REG_NEWLINE },
+		{ "shdoc12json", REG_ICASE | REG_NEWLINE | M_FUZZY },
+		{ "^/usr json$ 'share", REG_ICASE | REG_NEWLINE | M_EXTENDED },
+	};
+	const mspan *S;
+	double t[3];
+	int q, i, r, h = 0;
+	corpus C;
+	matcher M;
+	mlist L;
+
+	if (map_corpus(&C, mib, 0) || matcher_init(&M, threads)) {
+		return 1;
+	}
+	printf("spans: %d lines\n", C.num);
+	printf("  %-24s %10s %10s %10s\n", "query", "screen", "cached", "all");
+	for (q = 0; q < (int)(sizeof(query)/sizeof(query[0])); q++) {
+		matcher_compile(&M, query[q].q, query[q].cflags);
+		mlist_init(&L);
+		entry_match(&M, &C, 0, C.num, &L);
+		entry_rank(&M, &L, L.n);
+		for (r = 0; r < 2; r++) {
+			t[r] = now();
+			for (i = 1; i <= ROWS && i <= L.n; i++) {
+				h += entry_spans(&M, &C, mlist_id(&L, i), &S);
+			}
+			t[r] = now() - t[r];
+		}
+		t[2] = now();
+		for (i = 1; i <= L.n; i++) {
+			h += entry_spans(&M, &C, mlist_id(&L, i), &S);
+		}
+		t[2] = now() - t[2];
+		printf("  %-24s %7.3f ms %7.3f ms %7.3f ms %d matches\n", query[q].q,
+			t[0] * 1e3, t[1] * 1e3, t[2] * 1e3, L.n);
+		mlist_free(&L);
+	}
+	matcher_free(&M);
+	corpus_free(&C);
+	return !h;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t mib = 0;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (argc > 2) {
+		mib = strtoul(argv[2], 0, 10);
+	}
+	if (argc > 3) {
+		threads = atoi(argv[3]);
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (argc < 2 || !strcmp(argv[1], "ingest")) {
+		return bench_ingest(mib ? mib : 256);
+	}
+	if (!strcmp(argv[1], "match")) {
+		return bench_match(mib ? mib : 64, threads);
+	}
+	if (!strcmp(argv[1], "keys")) {
+		return bench_keys(mib ? mib : 64, threads);
+	}
+	if (!strcmp(argv[1], "index")) {
+		return bench_index(mib ? mib : 64, threads);
+	}
+	if (!strcmp(argv[1], "sets")) {
+		return bench_sets(mib ? mib : 64, threads);
+	}
+	if (!strcmp(argv[1], "rank")) {
+		return bench_rank(mib ? mib : 64, threads);
+	}
+	if (!strcmp(argv[1], "fold")) {
+		return bench_fold(mib ? mib : 64, threads);
+	}
+	if (!strcmp(argv[1], "fields")) {
+		return bench_fields(mib ? mib : 64, threads);
+	}
+	if (!strcmp(argv[1], "spans")) {
+		return bench_spans(mib ? mib : 64, threads);
+	}
+	fprintf(stderr, "Usage: %s [ingest|match|keys|index|sets|rank|fold|fields|spans] [MiB] [threads]\n", argv[0]);
+	return 1;
+}
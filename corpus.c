@@ -0,0 +1,601 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _DEFAULT_SOURCE
+	#define _DEFAULT_SOURCE
+#endif
+
+#include "corpus.h"
+#include "utf8.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+void *arena_alloc(arena *A, size_t s)
+{
+	slab *S = A->head;
+	size_t z;
+
+	if (!S || S->size - S->used < s) {
+		z = s > ARENA_SLAB ? s : ARENA_SLAB;
+		if (!(S = malloc(sizeof(slab)+z))) {
+			return 0;
+		}
+		S->size = z;
+		S->used = 0;
+		/* Oversized allocation must not waste what is left in head */
+		if (A->head && z != ARENA_SLAB) {
+			S->next = A->head->next;
+			A->head->next = S;
+		}
+		else {
+			S->next = A->head;
+			A->head = S;
+		}
+	}
+	S->used += s;
+	return S->mem + S->used - s;
+}
+
+void arena_free(arena *A)
+{
+	slab *S;
+
+	while (A->head) {
+		S = A->head;
+		A->head = S->next;
+		free(S);
+	}
+}
+
+void corpus_init(corpus *C)
+{
+	memset(C, 0, sizeof(*C));
+}
+
+/*
+ * Sets sp to offset and length of fields r[0] to r[1] of s, split by d.
+ * Offsets past 4 GiB are cut.
+ */
+static void field_span(const char *s, size_t L, char d, const int r[2], uint32_t sp[2])
+{
+	const char *p, *q, *e = s + L, *from = e, *to = e;
+	int n = 1, a, b, i;
+
+	/* Fields are counted only if counted from the last */
+	if (r[0] == 1 && r[1] == -1) {
+		from = s;
+	}
+	else {
+		for (p = s; (r[0] < 0 || r[1] < 0) && (p = memchr(p, d, e - p)); p++) {
+			n++;
+		}
+		a = r[0] < 0 ? n + 1 + r[0] : r[0];
+		b = r[1] < 0 ? n + 1 + r[1] : r[1];
+		for (p = s, i = 1; i <= b; i++, p = q+1) {
+			if (!(q = memchr(p, d, e - p))) {
+				q = e;
+			}
+			if (i == a || (i == 1 && a < 1)) {
+				from = p;
+			}
+			to = q;
+			if (q == e) {
+				break;
+			}
+		}
+	}
+	if (from > to) {
+		from = to;
+	}
+	sp[0] = from - s < UINT32_MAX ? from - s : UINT32_MAX;
+	sp[1] = to - from < UINT32_MAX - sp[0] ? to - from : UINT32_MAX - sp[0];
+}
+
+/* Adds entry that points to s. s must outlive the corpus. */
+entry *corpus_ref(corpus *C, char *s, size_t L)
+{
+	entry *e, **nb;
+	uint64_t **nm;
+	uint32_t **nf;
+	summary *ns;
+	size_t b = C->num / CORPUS_BLOCK, z = C->blks ? 2*C->blks : 16;
+
+	if (b == C->blks) {
+		nb = realloc(C->blk, z * sizeof(entry*));
+		if (!nb) return 0;
+		C->blk = nb;
+		nm = realloc(C->mask, z * sizeof(uint64_t*));
+		if (!nm) return 0;
+		C->mask = nm;
+		if (C->split) {
+			nf = realloc(C->field, z * sizeof(uint32_t*));
+			if (!nf) return 0;
+			C->field = nf;
+		}
+		ns = realloc(C->sum, z * sizeof(summary));
+		if (!ns) return 0;
+		C->sum = ns;
+		memset(C->sum + C->blks, 0, (z - C->blks) * sizeof(summary));
+		C->blks = z;
+	}
+	if (C->num % CORPUS_BLOCK == 0) {
+		if (!(C->blk[b] = malloc(CORPUS_BLOCK * sizeof(entry)))) {
+			return 0;
+		}
+		if (!(C->mask[b] = malloc(CORPUS_BLOCK * sizeof(uint64_t)))) {
+			free(C->blk[b]);
+			return 0;
+		}
+		if (C->split && !(C->field[b] = malloc(CORPUS_BLOCK * 4 * sizeof(uint32_t)))) {
+			free(C->blk[b]);
+			free(C->mask[b]);
+			return 0;
+		}
+	}
+	e = &C->blk[b][C->num % CORPUS_BLOCK];
+	e->str = s;
+	e->L = L;
+	e->selected = 0;
+	e->fL = 0;
+	C->mask[b][C->num % CORPUS_BLOCK] = str_mask(s, L);
+	if (C->split) {
+		field_span(s, L, C->fdelim, C->nth, CORPUS_FIELDS(C, C->num));
+		field_span(s, L, C->fdelim, C->show, CORPUS_FIELDS(C, C->num) + 2);
+	}
+	C->num++;
+	return e;
+}
+
+/*
+ * Folds last entry e, or its matched fields, into f, which has room for it.
+ * Copies of entries longer than 4 GiB are cut.
+ */
+static void corpus_fold(corpus *C, entry *e, char *f)
+{
+	int i = C->num - 1;
+	uint32_t *sp = C->split ? CORPUS_FIELDS(C, i) : 0;
+
+	if (sp) {
+		e->fL = str_fold(f, e->str + sp[0], sp[1], C->fold);
+	}
+	else {
+		e->fL = str_fold(f, e->str, e->L < UINT32_MAX ? e->L : UINT32_MAX, C->fold);
+	}
+	C->mask[i/CORPUS_BLOCK][i%CORPUS_BLOCK] |= str_mask(f, e->fL);
+	C->folded += e->L + 1;
+}
+
+/* Adds a copy of s */
+entry *corpus_add(corpus *C, char *s, size_t L)
+{
+	entry *e;
+	char *d;
+
+	if (!(d = arena_alloc(&C->A, C->fold ? 2*L+2 : L+1))) {
+		return 0;
+	}
+	memcpy(d, s, L);
+	d[L] = 0;
+	if (!(e = corpus_ref(C, d, L))) {
+		return 0;
+	}
+	if (C->fold) {
+		corpus_fold(C, e, d+L+1);
+		d[L+1+e->fL] = 0;
+	}
+	return e;
+}
+
+/*
+ * Adds entries of block b that came since last time to its summary.
+ * Summaries are made when first needed, by the thread matching the block.
+ */
+void corpus_summarize(corpus *C, int b)
+{
+	summary *S = &C->sum[b];
+	entry *e;
+	int n = C->num - b*CORPUS_BLOCK;
+
+	if (n > CORPUS_BLOCK) {
+		n = CORPUS_BLOCK;
+	}
+	if (!S->n) {
+		S->minL = (size_t)-1;
+	}
+	for (; S->n < n; S->n++) {
+		e = &C->blk[b][S->n];
+		S->mask |= C->mask[b][S->n];
+		S->minL = e->L < S->minL ? e->L : S->minL;
+		S->maxL = e->L > S->maxL ? e->L : S->maxL;
+		str_bigrams(e->str, e->L, S->bigram);
+		if (C->fold) {
+			str_bigrams(CORPUS_FOLDED(C, e), e->fL, S->bigram);
+		}
+	}
+}
+
+/*
+ * If fd is a regular file it is mapped and entries point into the mapping.
+ * Returns number of entries, -1 if fd can't be mapped or -2 on error.
+ */
+int corpus_map(corpus *C, int fd, char delim)
+{
+	struct stat st;
+	char *m, *s, *e, *nl;
+	entry *E;
+	size_t L;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		return -1;
+	}
+	m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED) {
+		return -1;
+	}
+	C->map = m;
+	C->mapsize = st.st_size;
+	if (C->fold && !(C->fmap = malloc(st.st_size))) {
+		return -2;
+	}
+	s = m;
+	e = m + st.st_size;
+	while (s < e) {
+		if (!(nl = find_delim(s, e, delim))) {
+			nl = e;
+		}
+		L = nl - s;
+		if (delim == '\n' && L && s[L-1] == '\r') {
+			L--;
+		}
+		if (!(E = corpus_ref(C, s, L))) {
+			return -2;
+		}
+		if (C->fold) {
+			corpus_fold(C, E, CORPUS_FOLDED(C, E));
+		}
+		s = nl+1;
+	}
+	return C->num;
+}
+
+void corpus_free(corpus *C)
+{
+	int b;
+
+	for (b = 0; b*CORPUS_BLOCK < C->num; b++) {
+		free(C->blk[b]);
+		free(C->mask[b]);
+		if (C->field) {
+			free(C->field[b]);
+		}
+	}
+	free(C->blk);
+	free(C->mask);
+	free(C->field);
+	free(C->sum);
+	arena_free(&C->A);
+	if (C->map) {
+		munmap(C->map, C->mapsize);
+	}
+	free(C->fmap);
+	memset(C, 0, sizeof(*C));
+}
+
+/* Returns pointer to the first c in [s, e) or 0 */
+char *find_delim(char *s, char *e, char c)
+{
+#if defined(__AVX2__)
+	__m256i C = _mm256_set1_epi8(c);
+	uint32_t m;
+
+	while (e - s >= 32) {
+		m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(C,
+			_mm256_loadu_si256((__m256i*)s)));
+		if (m) {
+			return s + __builtin_ctz(m);
+		}
+		s += 32;
+	}
+#elif defined(__SSE2__)
+	__m128i C = _mm_set1_epi8(c), a, b, x, y;
+	uint64_t m;
+
+	/* 64 bytes per iteration. Masks are only combined on a hit. */
+	while (e - s >= 64) {
+		a = _mm_cmpeq_epi8(C, _mm_loadu_si128((__m128i*)s));
+		b = _mm_cmpeq_epi8(C, _mm_loadu_si128((__m128i*)(s+16)));
+		x = _mm_cmpeq_epi8(C, _mm_loadu_si128((__m128i*)(s+32)));
+		y = _mm_cmpeq_epi8(C, _mm_loadu_si128((__m128i*)(s+48)));
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b),
+		                                   _mm_or_si128(x, y)))) {
+			m = (uint64_t)_mm_movemask_epi8(a)
+			  | (uint64_t)_mm_movemask_epi8(b) << 16
+			  | (uint64_t)_mm_movemask_epi8(x) << 32
+			  | (uint64_t)_mm_movemask_epi8(y) << 48;
+			return s + __builtin_ctzll(m);
+		}
+		s += 64;
+	}
+	while (e - s >= 16) {
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(C,
+			_mm_loadu_si128((__m128i*)s)));
+		if (m) {
+			return s + __builtin_ctz(m);
+		}
+		s += 16;
+	}
+#endif
+	while (s < e) {
+		if (*s == c) {
+			return s;
+		}
+		s++;
+	}
+	return 0;
+}
+
+void reader_init(reader *R, int fd, char delim)
+{
+	memset(R, 0, sizeof(*R));
+	R->fd = fd;
+	R->delim = delim;
+}
+
+/* Adds line [s, s+L) dropping the \r of \r\n */
+static entry *add_line(corpus *C, char *s, size_t L, char delim)
+{
+	if (delim == '\n' && L && s[L-1] == '\r') {
+		L--;
+	}
+	return corpus_add(C, s, L);
+}
+
+/*
+ * Reads whatever is available without blocking and adds complete lines.
+ * Stops after max lines, setting R->more if there may be more to split.
+ * Returns number of lines added or -1 on error. R->eof is set if the error
+ * is in reading, and not if memory ran out.
+ */
+int read_entries(reader *R, corpus *C, int max)
+{
+	char *nl, *nb;
+	ssize_t r;
+	int n = 0;
+
+	R->more = 0;
+	for (;;) {
+		while ((nl = find_delim(R->buf+R->scan, R->buf+R->end, R->delim))) {
+			if (!add_line(C, R->buf+R->beg, nl-(R->buf+R->beg), R->delim)) {
+				return -1;
+			}
+			R->beg = R->scan = nl+1-R->buf;
+			if (++n == max) {
+				R->more = 1;
+				return n;
+			}
+		}
+		R->scan = R->end;
+		if (R->eof) {
+			return n;
+		}
+		if (R->beg) {
+			memmove(R->buf, R->buf+R->beg, R->end-R->beg);
+			R->end -= R->beg;
+			R->scan -= R->beg;
+			R->beg = 0;
+		}
+		if (R->end == R->bufs) {
+			nb = realloc(R->buf, R->bufs ? 2*R->bufs : READER_BUF);
+			if (!nb) {
+				return -1;
+			}
+			R->buf = nb;
+			R->bufs = R->bufs ? 2*R->bufs : READER_BUF;
+		}
+		r = read(R->fd, R->buf+R->end, R->bufs-R->end);
+		if (r == -1 && (errno == EAGAIN || errno == EINTR)) {
+			return n;
+		}
+		if (r == -1) {
+			R->eof = 1;
+			return -1;
+		}
+		if (r == 0) {
+			/* Last line has no newline */
+			if (R->end != R->beg) {
+				if (!add_line(C, R->buf+R->beg, R->end-R->beg, R->delim)) {
+					return -1;
+				}
+				R->beg = R->scan = R->end;
+				n++;
+			}
+			R->eof = 1;
+			return n;
+		}
+		R->end += r;
+	}
+}
+
+void reader_free(reader *R)
+{
+	free(R->buf);
+	memset(R, 0, sizeof(*R));
+}
+
+/*
+ * Bit of each byte in a mask of characters: letters regardless of case,
+ * digits, space, other printable characters sharing 26 bits, and the rest.
+ */
+static unsigned char charidx[256];
+static uint64_t charbit[256];
+
+static void charbit_init(void)
+{
+	int c;
+
+	if (charbit['a']) {
+		return;
+	}
+	for (c = 0; c < 256; c++) {
+		if ('a' <= (c | 0x20) && (c | 0x20) <= 'z') {
+			charidx[c] = (c | 0x20) - 'a';
+		}
+		else if ('0' <= c && c <= '9') {
+			charidx[c] = 26 + c - '0';
+		}
+		else if (c == ' ') {
+			charidx[c] = 36;
+		}
+		else if (' ' < c && c < 0x7f) {
+			charidx[c] = 37 + c % 26;
+		}
+		else {
+			charidx[c] = 63;
+		}
+		charbit[c] = 1ull << charidx[c];
+	}
+}
+
+/* Returns index of the bit of each byte in str_mask() */
+const unsigned char *str_classes(void)
+{
+	charbit_init();
+	return charidx;
+}
+
+/*
+ * Sets bit 64*a+b of B for each two adjacent characters of s
+ * of bits a and b in str_mask()
+ */
+void str_bigrams(const char *s, size_t L, uint64_t B[64])
+{
+	const unsigned char *p = (const unsigned char*)s;
+	size_t i;
+
+	charbit_init();
+	for (i = 1; i < L; i++) {
+		B[charidx[p[i-1]]] |= charbit[p[i]];
+	}
+}
+
+/* Returns mask of characters in s. Any string that contains s has them. */
+uint64_t str_mask(const char *s, size_t L)
+{
+	const unsigned char *p = (const unsigned char*)s;
+	uint64_t a = 0, b = 0;
+	size_t i;
+
+	charbit_init();
+	for (i = 0; i+1 < L; i += 2) {
+		a |= charbit[p[i]];
+		b |= charbit[p[i+1]];
+	}
+	if (i < L) {
+		a |= charbit[p[i]];
+	}
+	return a | b;
+}
+
+/*
+ * Folds character at p, of at most n bytes, into d and returns its length.
+ * Sets *k to length of what it folds to. Invalid UTF-8 is copied as it is.
+ */
+static size_t fold_char(char *d, const unsigned char *p, size_t n, int how, size_t *k)
+{
+	size_t b = utf8_b2len((char*)p), i;
+	int cp;
+
+	*k = 1;
+	if (*p < 0x80) {
+		*d = 'A' <= *p && *p <= 'Z' ? *p | 0x20 : *p;
+		return 1;
+	}
+	if (b < 2 || b > n) {
+		*d = *p;
+		return 1;
+	}
+	cp = *p & (0x7f >> b);
+	for (i = 1; i < b; i++) {
+		if ((p[i] & 0xc0) != 0x80) {
+			*d = *p;
+			return 1;
+		}
+		cp = cp << 6 | (p[i] & 0x3f);
+	}
+	cp = utf8_fold(cp, how & FOLD_MARKS);
+	*k = cp < 0 ? 0 : (size_t)utf8_enchar(cp, d);
+	return b;
+}
+
+/*
+ * Copies L bytes of s to d in lower case, also without diacritics
+ * if how has FOLD_MARKS, and returns length of the copy.
+ * It is never longer than s, and d may be s.
+ */
+size_t str_fold(char *d, const char *s, size_t L, int how)
+{
+	const unsigned char *p = (const unsigned char*)s;
+	size_t i, j, k;
+	char c[4];
+
+	for (i = j = 0; i < L; j += k) {
+		if (p[i] < 0x80) {
+			d[j] = 'A' <= p[i] && p[i] <= 'Z' ? p[i] | 0x20 : p[i];
+			k = 1;
+			i++;
+			continue;
+		}
+		i += fold_char(c, p+i, L-i, how, &k);
+		memcpy(d+j, c, k);
+	}
+	return j;
+}
+
+/*
+ * Returns offset in s of the character at offset off of str_fold() of s.
+ * Combining marks left out of the copy go with the character before them.
+ */
+size_t str_unfold(const char *s, size_t L, size_t off, int how)
+{
+	const unsigned char *p = (const unsigned char*)s;
+	size_t i, j, k, b;
+	char c[4];
+
+	for (i = j = 0; i < L; i += b, j += k) {
+		b = fold_char(c, p+i, L-i, how, &k);
+		if (j >= off && k) {
+			break;
+		}
+	}
+	return i;
+}
@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Entries are kept in fixed-size blocks, so they never move once added */
+#define CORPUS_BLOCK 4096
+
+/* Strings are packed into slabs of at least this size */
+#define ARENA_SLAB (1024*1024)
+
+/* Initial size of reader buffer. It grows to fit the longest line. */
+#define READER_BUF (64*1024)
+
+#define CORPUS_AT(C, i) (&(C)->blk[(i)/CORPUS_BLOCK][(i)%CORPUS_BLOCK])
+
+/* Offset and length of matched, then of shown fields of entry i */
+#define CORPUS_FIELDS(C, i) ((C)->field[(i)/CORPUS_BLOCK] + 4*((i)%CORPUS_BLOCK))
+
+/* str_fold() copy of entry e, if the corpus keeps them */
+#define CORPUS_FOLDED(C, e) \
+	((C)->map ? (C)->fmap + ((e)->str - (C)->map) : (e)->str + (e)->L + 1)
+
+/* How str_fold() folds */
+#define FOLD_CASE 1
+#define FOLD_MARKS 2 /* Also strip diacritics */
+
+typedef struct entry {
+	char *str;
+	size_t L;
+	_Bool selected;
+	uint32_t fL; /* Length of the folded copy, if the corpus keeps them */
+} entry;
+
+typedef struct slab {
+	struct slab *next;
+	size_t size, used;
+	char mem[];
+} slab;
+
+/* Bump allocator. There is no way to free a single allocation. */
+typedef struct arena {
+	slab *head;
+} arena;
+
+/* What all entries of a block have in common, see corpus_summarize() */
+typedef struct summary {
+	int n; /* Entries summarized */
+	uint64_t mask; /* OR of str_mask() of entries */
+	size_t minL, maxL;
+	uint64_t bigram[64]; /* str_bigrams() of entries */
+} summary;
+
+typedef struct corpus {
+	entry **blk;
+	uint64_t **mask; /* str_mask() of each entry, in blocks like blk */
+	summary *sum; /* Of each block */
+	size_t blks;
+	int num;
+	arena A;
+	char *map; /* Entries point into this mapping and are not terminated */
+	size_t mapsize;
+	/*
+	 * Keep a str_fold() copy of each entry folded as fold says,
+	 * right after the entry in the arena or at the same offset in fmap.
+	 * Set before adding any. Masks and summaries cover copies too.
+	 */
+	int fold;
+	char *fmap;
+	size_t folded; /* Bytes the copies take */
+	/*
+	 * If split, entries are split into fields by fdelim. Only fields
+	 * nth[0] to nth[1] are matched (and folded) and show[0] to show[1]
+	 * shown. Fields count from 1, or from -1 for the last one.
+	 * Set before adding any.
+	 */
+	_Bool split;
+	char fdelim;
+	int nth[2], show[2];
+	uint32_t **field; /* CORPUS_FIELDS() of each entry, in blocks like blk */
+} corpus;
+
+typedef struct reader {
+	int fd;
+	_Bool eof, more;
+	char delim;
+	char *buf;
+	size_t bufs,
+	       beg, /* Start of the first incomplete line */
+	       scan, /* Bytes before this offset contain no delimiter */
+	       end;
+} reader;
+
+void *arena_alloc(arena*, size_t);
+void arena_free(arena*);
+
+void corpus_init(corpus*);
+entry *corpus_add(corpus*, char*, size_t);
+entry *corpus_ref(corpus*, char*, size_t);
+int corpus_map(corpus*, int, char);
+void corpus_summarize(corpus*, int);
+void corpus_free(corpus*);
+
+char *find_delim(char*, char*, char);
+uint64_t str_mask(const char*, size_t);
+void str_bigrams(const char*, size_t, uint64_t[64]);
+const unsigned char *str_classes(void);
+size_t str_fold(char*, const char*, size_t, int);
+size_t str_unfold(const char*, size_t, size_t, int);
+
+void reader_init(reader*, int, char);
+int read_entries(reader*, corpus*, int);
+void reader_free(reader*);
+
+#endif
@@ -0,0 +1,882 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Regex engine for the common part of POSIX BRE and ERE. Pattern is
+ * parsed to a tree, compiled to a Thompson NFA and matched by a DFA whose
+ * states are built the first time they are reached. Anything the parser
+ * is not sure about (backreferences, GNU escapes, equivalence classes,
+ * undefined corners of the syntax) makes nfa_compile() fail, so that
+ * the caller can leave the pattern to regcomp().
+ * There is no locale support. Like regcomp() in the C locale,
+ * a character is a byte.
+ */
+
+#include "dfa.h"
+#include <ctype.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Same as RE_DUP_MAX of POSIX */
+#define REP_MAX 255
+
+enum {
+	R_SET,
+	R_CAT,
+	R_ALT,
+	R_REP,
+	R_BOL,
+	R_EOL,
+};
+
+typedef struct rnode {
+	unsigned char op;
+	int a, b;
+	int min, max; /* R_REP, max < 0 if unbounded */
+	int set;
+} rnode;
+
+typedef struct parser {
+	const char *p;
+	_Bool ere, icase;
+	rnode *R;
+	int n, cap;
+	nfa *A;
+} parser;
+
+/* Targets of transitions that end the search */
+static dstate matched, unmatched;
+
+static void set_add(uint32_t *s, int c)
+{
+	s[c >> 5] |= 1u << (c & 31);
+}
+
+static _Bool set_has(const uint32_t *s, int c)
+{
+	return s[c >> 5] >> (c & 31) & 1;
+}
+
+static int new_set(nfa *A)
+{
+	uint32_t (*s)[8];
+
+	if (A->sets == A->setcap) {
+		s = realloc(A->set, (A->setcap ? 2*A->setcap : 16) * sizeof(*s));
+		if (!s) return -1;
+		A->set = s;
+		A->setcap = A->setcap ? 2*A->setcap : 16;
+	}
+	memset(A->set[A->sets], 0, sizeof(A->set[0]));
+	return A->sets++;
+}
+
+static int new_node(parser *P, int op, int a, int b)
+{
+	rnode *R;
+
+	if (P->n == P->cap) {
+		if (!(R = realloc(P->R, (P->cap ? 2*P->cap : 32) * sizeof(rnode)))) {
+			return -1;
+		}
+		P->R = R;
+		P->cap = P->cap ? 2*P->cap : 32;
+	}
+	R = &P->R[P->n];
+	memset(R, 0, sizeof(*R));
+	R->op = op;
+	R->a = a;
+	R->b = b;
+	return P->n++;
+}
+
+/* Node of a byte set that is filled in by the caller */
+static int set_node(parser *P, uint32_t **s)
+{
+	int r, i;
+
+	if ((i = new_set(P->A)) < 0 || (r = new_node(P, R_SET, 0, 0)) < 0) {
+		return -1;
+	}
+	P->R[r].set = i;
+	*s = P->A->set[i];
+	return r;
+}
+
+/* Adds the other case of letters already in s */
+static void set_fold(uint32_t *s)
+{
+	int c;
+
+	for (c = 'a'; c <= 'z'; c++) {
+		if (set_has(s, c) || set_has(s, c - 'a' + 'A')) {
+			set_add(s, c);
+			set_add(s, c - 'a' + 'A');
+		}
+	}
+}
+
+static int char_node(parser *P, int c)
+{
+	uint32_t *s;
+	int r;
+
+	if ((r = set_node(P, &s)) < 0) {
+		return -1;
+	}
+	set_add(s, c);
+	if (P->icase) {
+		set_fold(s);
+	}
+	return r;
+}
+
+static int dot_node(parser *P)
+{
+	uint32_t *s;
+	int r;
+
+	if ((r = set_node(P, &s)) < 0) {
+		return -1;
+	}
+	memset(s, 0xff, 32);
+	if (P->A->newline) {
+		s[0] &= ~(1u << '\n');
+	}
+	return r;
+}
+
+static int class_add(uint32_t *s, const char *name, size_t n)
+{
+	static const struct {
+		const char *name;
+		int (*is)(int);
+	} cc[] = {
+		{ "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+		{ "upper", isupper }, { "lower", islower }, { "space", isspace },
+		{ "blank", isblank }, { "punct", ispunct }, { "print", isprint },
+		{ "graph", isgraph }, { "cntrl", iscntrl }, { "xdigit", isxdigit },
+	};
+	size_t i;
+	int c;
+
+	for (i = 0; i < sizeof(cc)/sizeof(cc[0]); i++) {
+		if (strlen(cc[i].name) == n && !memcmp(cc[i].name, name, n)) {
+			for (c = 0; c < 128; c++) {
+				if (cc[i].is(c)) set_add(s, c);
+			}
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int parse_bracket(parser *P)
+{
+	const char *p = P->p + 1, *e;
+	_Bool neg = 0, first = 1;
+	uint32_t *s;
+	int r, c, d, i;
+
+	if ((r = set_node(P, &s)) < 0) {
+		return -1;
+	}
+	if (*p == '^') {
+		neg = 1;
+		p++;
+	}
+	for (;; first = 0) {
+		c = (unsigned char)*p;
+		if (!c) {
+			return -1;
+		}
+		if (c == ']' && !first) {
+			p++;
+			break;
+		}
+		if (c == '[' && (p[1] == '=' || p[1] == '.')) {
+			return -1;
+		}
+		if (c == '[' && p[1] == ':') {
+			if (!(e = strstr(p+2, ":]")) || class_add(s, p+2, e-p-2)) {
+				return -1;
+			}
+			p = e + 2;
+			continue;
+		}
+		/* Dash that neither starts nor ends the list */
+		if (c == '-' && !first && p[1] != ']') {
+			return -1;
+		}
+		p++;
+		d = c;
+		if (*p == '-' && p[1] && p[1] != ']') {
+			d = (unsigned char)p[1];
+			if (d == '[' || d < c) {
+				return -1;
+			}
+			p += 2;
+		}
+		for (; c <= d; c++) {
+			set_add(s, c);
+		}
+	}
+	if (P->icase) {
+		set_fold(s);
+	}
+	if (neg) {
+		for (i = 0; i < 8; i++) {
+			s[i] = ~s[i];
+		}
+		if (P->A->newline) {
+			s[0] &= ~(1u << '\n');
+		}
+	}
+	P->p = p;
+	return r;
+}
+
+/* Parses {m}, {m,} or {m,n}. p points after the opening brace. */
+static int parse_interval(parser *P, int *min, int *max)
+{
+	long m, n;
+	char *e;
+
+	if (!isdigit((unsigned char)*P->p)) {
+		return -1;
+	}
+	m = n = strtol(P->p, &e, 10);
+	if (*e == ',') {
+		n = -1;
+		if (isdigit((unsigned char)*++e)) {
+			n = strtol(e, &e, 10);
+		}
+	}
+	if (P->ere ? *e != '}' : (e[0] != '\\' || e[1] != '}')) {
+		return -1;
+	}
+	if (m > REP_MAX || n > REP_MAX || (n >= 0 && n < m)) {
+		return -1;
+	}
+	P->p = e + (P->ere ? 1 : 2);
+	*min = m;
+	*max = n;
+	return 0;
+}
+
+static int parse_alt(parser*, int);
+static int parse_cat(parser*, int);
+
+static int parse_atom(parser *P, int depth, _Bool first)
+{
+	const char *p = P->p;
+	int r;
+
+	switch (*p) {
+	case '.':
+		P->p++;
+		return dot_node(P);
+	case '[':
+		return parse_bracket(P);
+	case '\\':
+		if (!P->ere && p[1] == '(') {
+			P->p += 2;
+			r = parse_cat(P, depth+1);
+			if (r < 0 || P->p[0] != '\\' || P->p[1] != ')') {
+				return -1;
+			}
+			P->p += 2;
+			return r;
+		}
+		if (!p[1] || !strchr(P->ere ? "^.[$()|*+?{}\\" : ".[\\*^$", p[1])) {
+			return -1;
+		}
+		P->p += 2;
+		return char_node(P, (unsigned char)p[1]);
+	}
+	if (P->ere) {
+		switch (*p) {
+		case '(':
+			P->p++;
+			r = parse_alt(P, depth+1);
+			if (r < 0 || *P->p != ')') {
+				return -1;
+			}
+			P->p++;
+			return r;
+		case '^':
+			P->p++;
+			return new_node(P, R_BOL, 0, 0);
+		case '$':
+			P->p++;
+			return new_node(P, R_EOL, 0, 0);
+		case '*': case '+': case '?': case '{': case '}':
+			return -1;
+		}
+	}
+	else {
+		/* Anchors only at the ends of the whole pattern */
+		if (*p == '$' && p[1] == '\\' && p[2] == ')') {
+			return -1;
+		}
+		if (*p == '$' && !p[1] && !depth) {
+			P->p++;
+			return new_node(P, R_EOL, 0, 0);
+		}
+		if ((*p == '*' || *p == '^') && first && depth) {
+			return -1;
+		}
+		if (*p == '*' && !first) {
+			return -1;
+		}
+	}
+	P->p++;
+	return char_node(P, (unsigned char)*p);
+}
+
+static int parse_rep(parser *P, int depth, _Bool first)
+{
+	int r, min, max;
+	const char *p;
+
+	if ((r = parse_atom(P, depth, first)) < 0) {
+		return -1;
+	}
+	p = P->p;
+	if (*p == '*') {
+		min = 0, max = -1;
+		P->p++;
+	}
+	else if (P->ere && (*p == '+' || *p == '?')) {
+		min = *p == '+';
+		max = *p == '+' ? -1 : 1;
+		P->p++;
+	}
+	else if (P->ere ? *p == '{' : p[0] == '\\' && p[1] == '{') {
+		P->p += P->ere ? 1 : 2;
+		if (parse_interval(P, &min, &max)) {
+			return -1;
+		}
+	}
+	else {
+		return r;
+	}
+	p = P->p;
+	if (P->R[r].op == R_BOL || P->R[r].op == R_EOL
+	|| *p == '*' || (P->ere && strchr("+?{", *p) && *p)
+	|| (!P->ere && p[0] == '\\' && p[1] == '{')) {
+		return -1;
+	}
+	if ((r = new_node(P, R_REP, r, 0)) < 0) {
+		return -1;
+	}
+	P->R[r].min = min;
+	P->R[r].max = max;
+	return r;
+}
+
+/* Returns -1 if the sequence is empty */
+static int parse_cat(parser *P, int depth)
+{
+	const char *start = P->p;
+	int a = -1, b;
+
+	if (!P->ere && !depth && *P->p == '^') {
+		P->p++;
+		if ((a = new_node(P, R_BOL, 0, 0)) < 0) {
+			return -1;
+		}
+		start = P->p;
+	}
+	while (*P->p) {
+		if (P->ere && (*P->p == '|' || *P->p == ')')) {
+			break;
+		}
+		if (!P->ere && P->p[0] == '\\' && P->p[1] == ')') {
+			break;
+		}
+		if ((b = parse_rep(P, depth, P->p == start)) < 0) {
+			return -1;
+		}
+		if ((a = a < 0 ? b : new_node(P, R_CAT, a, b)) < 0) {
+			return -1;
+		}
+	}
+	return a;
+}
+
+static int parse_alt(parser *P, int depth)
+{
+	int a, b;
+
+	if ((a = parse_cat(P, depth)) < 0) {
+		return -1;
+	}
+	while (P->ere && *P->p == '|') {
+		P->p++;
+		if ((b = parse_cat(P, depth)) < 0) {
+			return -1;
+		}
+		if ((a = new_node(P, R_ALT, a, b)) < 0) {
+			return -1;
+		}
+	}
+	return a;
+}
+
+static int emit(nfa *A, int op, int out, int out1, int set)
+{
+	nnode *N;
+
+	if (A->n == NFA_MAX) {
+		return -1;
+	}
+	if (A->n == A->cap) {
+		if (!(N = realloc(A->N, (A->cap ? 2*A->cap : 64) * sizeof(nnode)))) {
+			return -1;
+		}
+		A->N = N;
+		A->cap = A->cap ? 2*A->cap : 64;
+	}
+	N = &A->N[A->n];
+	N->op = op;
+	N->out = out;
+	N->out1 = out1;
+	N->set = set;
+	return A->n++;
+}
+
+/* Returns start of the NFA of node r, which continues to next */
+static int build(parser *P, int r, int next)
+{
+	nfa *A = P->A;
+	rnode *R = &P->R[r];
+	int s, t, i;
+
+	switch (R->op) {
+	case R_SET:
+		return emit(A, N_SET, next, 0, R->set);
+	case R_BOL:
+		return emit(A, N_BOL, next, 0, 0);
+	case R_EOL:
+		return emit(A, N_EOL, next, 0, 0);
+	case R_CAT:
+		if ((t = build(P, R->b, next)) < 0) {
+			return -1;
+		}
+		return build(P, R->a, t);
+	case R_ALT:
+		if ((s = build(P, R->a, next)) < 0 || (t = build(P, R->b, next)) < 0) {
+			return -1;
+		}
+		return emit(A, N_SPLIT, s, t, 0);
+	}
+	/* R_REP: loop or optional copies, preceded by required copies */
+	t = next;
+	if (R->max < 0) {
+		if ((s = emit(A, N_SPLIT, 0, next, 0)) < 0 || (t = build(P, R->a, s)) < 0) {
+			return -1;
+		}
+		A->N[s].out = t;
+		t = s;
+	}
+	for (i = R->min; i < R->max; i++) {
+		if ((s = build(P, R->a, t)) < 0 || (t = emit(A, N_SPLIT, s, next, 0)) < 0) {
+			return -1;
+		}
+	}
+	for (i = 0; i < R->min; i++) {
+		if ((t = build(P, R->a, t)) < 0) {
+			return -1;
+		}
+	}
+	return t;
+}
+
+/* Splits bytes to classes that all sets, and the newline, tell apart */
+static void classify(nfa *A)
+{
+	int map[2*256];
+	int i, c, k = 1;
+	_Bool in;
+
+	memset(A->cls, 0, sizeof(A->cls));
+	for (i = 0; i <= A->sets; i++) {
+		memset(map, -1, sizeof(map));
+		for (k = 0, c = 0; c < 256; c++) {
+			in = i < A->sets ? set_has(A->set[i], c) : c == '\n';
+			if (map[2*A->cls[c] + in] < 0) {
+				A->rep[k] = c;
+				map[2*A->cls[c] + in] = k++;
+			}
+			A->cls[c] = map[2*A->cls[c] + in];
+		}
+	}
+	A->ncls = k;
+}
+
+/*
+ * What is known about strings matched by a node: the string itself if
+ * there is only one, what all of them start and end with, and the longest
+ * other string all of them contain.
+ */
+typedef struct linfo {
+	_Bool exact;
+	char pre[LIT_MAX+1], suf[LIT_MAX+1], in[LIT_MAX+1];
+} linfo;
+
+/* Returns the character a set stands for, or -1 if it's more than one */
+static int set_char(parser *P, const uint32_t *s)
+{
+	int c, n = 0, r = -1;
+
+	for (c = 0; c < 256; c++) {
+		if (set_has(s, c)) {
+			n++;
+			r = c;
+		}
+	}
+	if (n == 2 && P->icase && 'a' <= r && r <= 'z' && set_has(s, r - 'a' + 'A')) {
+		return r;
+	}
+	return n == 1 ? r : -1;
+}
+
+/* Appends b to a, keeping the first or the last LIT_MAX characters */
+static void lit_cat(char *d, const char *a, const char *b, _Bool tail)
+{
+	char t[2*LIT_MAX+1];
+	size_t n;
+
+	n = strlen(strcat(strcpy(t, a), b));
+	strcpy(d, tail && n > LIT_MAX ? t + n - LIT_MAX : t);
+	d[LIT_MAX] = 0;
+}
+
+static void lit_longer(char *d, const char *s)
+{
+	if (strlen(s) > strlen(d)) {
+		strcpy(d, s);
+	}
+}
+
+static void literals(parser *P, int r, linfo *I)
+{
+	rnode *R = &P->R[r];
+	linfo a, b;
+	char j[LIT_MAX+1];
+	int c, i;
+
+	memset(I, 0, sizeof(*I));
+	switch (R->op) {
+	case R_SET:
+		if ((c = set_char(P, P->A->set[R->set])) > 0) {
+			I->exact = 1;
+			I->pre[0] = I->suf[0] = c;
+		}
+		return;
+	case R_BOL:
+	case R_EOL:
+		I->exact = 1;
+		return;
+	case R_ALT:
+		return;
+	case R_CAT:
+		literals(P, R->a, &a);
+		literals(P, R->b, &b);
+		lit_cat(I->pre, a.pre, a.exact ? b.pre : "", 0);
+		lit_cat(I->suf, b.exact ? a.suf : "", b.suf, 1);
+		I->exact = a.exact && b.exact && strlen(a.pre) + strlen(b.pre) <= LIT_MAX;
+		lit_cat(j, a.suf, b.pre, 1);
+		lit_longer(I->in, a.in);
+		lit_longer(I->in, b.in);
+		lit_longer(I->in, j);
+		return;
+	}
+	/* R_REP */
+	if (R->min == 0) {
+		I->exact = R->max == 0;
+		return;
+	}
+	literals(P, R->a, &a);
+	*I = a;
+	I->exact = 0;
+	for (i = 1; a.exact && i < R->min; i++) {
+		lit_cat(I->pre, I->pre, a.pre, 0);
+		lit_cat(I->suf, I->suf, a.suf, 1);
+	}
+	I->exact = a.exact && R->min == R->max && strlen(a.pre) * R->min <= LIT_MAX;
+}
+
+/* Keeps the longest strings, dropping those contained in another one */
+static int add_literal(nfa *A, const char *s, _Bool icase)
+{
+	int i, j;
+	needle N;
+
+	if (!*s || A->lits == NFA_LITS) {
+		return 0;
+	}
+	if (needle_init(&N, s, strlen(s), icase)) {
+		return -1;
+	}
+	for (i = 0; i < A->lits; i++) {
+		if (needle_find(&N, A->lit[i].s, A->lit[i].n)) {
+			/* Already have something that contains s */
+			needle_free(&N);
+			return 0;
+		}
+	}
+	for (i = j = 0; i < A->lits; i++) {
+		if (needle_find(&A->lit[i], N.s, N.n)) {
+			needle_free(&A->lit[i]);
+		}
+		else {
+			A->lit[j++] = A->lit[i];
+		}
+	}
+	A->lits = j;
+	for (i = A->lits; i > 0 && A->lit[i-1].n < N.n; i--) {
+		A->lit[i] = A->lit[i-1];
+	}
+	A->lit[i] = N;
+	A->lits++;
+	return 0;
+}
+
+/* Returns 0 on success, -1 if the pattern is not supported */
+int nfa_compile(nfa *A, const char *re, int cflags)
+{
+	parser P;
+	linfo I;
+	int r, m;
+
+	memset(A, 0, sizeof(*A));
+	memset(&P, 0, sizeof(P));
+	P.p = re;
+	P.ere = !!(cflags & REG_EXTENDED);
+	P.icase = !!(cflags & REG_ICASE);
+	P.A = A;
+	A->newline = !!(cflags & REG_NEWLINE);
+	r = parse_alt(&P, 0);
+	if (r < 0 || *P.p
+	|| (m = emit(A, N_MATCH, 0, 0, 0)) < 0
+	|| (A->start = build(&P, r, m)) < 0) {
+		free(P.R);
+		nfa_free(A);
+		return -1;
+	}
+	literals(&P, r, &I);
+	free(P.R);
+	if (add_literal(A, I.in, P.icase)
+	|| add_literal(A, I.pre, P.icase)
+	|| add_literal(A, I.suf, P.icase)) {
+		nfa_free(A);
+		return -1;
+	}
+	classify(A);
+	return 0;
+}
+
+/* Tells whether s contains all required literals */
+_Bool nfa_prefilter(nfa *A, char *s, size_t n)
+{
+	int i;
+
+	for (i = 0; i < A->lits; i++) {
+		if (!needle_find(&A->lit[i], s, n)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void nfa_free(nfa *A)
+{
+	int i;
+
+	for (i = 0; i < A->lits; i++) {
+		needle_free(&A->lit[i]);
+	}
+	free(A->N);
+	free(A->set);
+	memset(A, 0, sizeof(*A));
+}
+
+int dfa_init(dfa *D, nfa *A)
+{
+	memset(D, 0, sizeof(*D));
+	D->A = A;
+	D->stack = malloc(A->n * sizeof(int));
+	D->list = malloc((A->n+1) * sizeof(int));
+	D->mark = calloc(A->n, sizeof(int));
+	if (!D->stack || !D->list || !D->mark) {
+		dfa_free(D);
+		return -1;
+	}
+	return 0;
+}
+
+void dfa_free(dfa *D)
+{
+	arena_free(&D->mem);
+	free(D->stack);
+	free(D->list);
+	free(D->mark);
+	memset(D, 0, sizeof(*D));
+}
+
+static void dfa_flush(dfa *D)
+{
+	arena_free(&D->mem);
+	memset(D->hash, 0, sizeof(D->hash));
+	D->size = 0;
+	D->init = 0;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+/* Returns state with sorted NFA states pc, adding it if needed */
+static dstate *intern(dfa *D, int *pc, int n, _Bool bol)
+{
+	unsigned h = bol;
+	size_t z, next = (D->A->ncls+1) * sizeof(dstate*);
+	dstate *s;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		h = h * 31 + pc[i];
+	}
+	for (s = D->hash[h % DFA_HASH]; s; s = s->hnext) {
+		if (s->hash == h && s->n == n && s->bol == bol
+		&& !memcmp(s->pc, pc, n * sizeof(int))) {
+			return s;
+		}
+	}
+	z = sizeof(dstate) + next + n * sizeof(int);
+	z = (z + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	if (!(s = arena_alloc(&D->mem, z))) {
+		return 0;
+	}
+	D->size += z;
+	memset(s->next, 0, next);
+	s->pc = (int*)((char*)s->next + next);
+	memcpy(s->pc, pc, n * sizeof(int));
+	s->n = n;
+	s->bol = bol;
+	s->hash = h;
+	s->hnext = D->hash[h % DFA_HASH];
+	D->hash[h % DFA_HASH] = s;
+	return s;
+}
+
+static void push(dfa *D, int *sp, int pc)
+{
+	if (D->mark[pc] != D->gen) {
+		D->mark[pc] = D->gen;
+		D->stack[(*sp)++] = pc;
+	}
+}
+
+/* Builds transition of d on class c, or on the end of text if c is ncls */
+static dstate *step(dfa *D, dstate *d, int c)
+{
+	nfa *A = D->A;
+	_Bool end = c == A->ncls;
+	int b = end ? -1 : A->rep[c]; /* rep has no entry for the end */
+	int i, j, n = 0, sp = 0;
+	nnode *N;
+	dstate *t;
+
+	if (++D->gen == 0) {
+		memset(D->mark, 0, A->n * sizeof(int));
+		D->gen = 1;
+	}
+	for (i = d->n; i-- > 0;) {
+		push(D, &sp, d->pc[i]);
+	}
+	while (sp) {
+		N = &A->N[D->stack[--sp]];
+		switch (N->op) {
+		case N_MATCH:
+			return d->next[c] = &matched;
+		case N_SPLIT:
+			push(D, &sp, N->out1);
+			push(D, &sp, N->out);
+			break;
+		case N_BOL:
+			if (d->bol) push(D, &sp, N->out);
+			break;
+		case N_EOL:
+			if (end || (A->newline && b == '\n')) push(D, &sp, N->out);
+			break;
+		case N_SET:
+			if (!end && set_has(A->set[N->set], b)) D->list[n++] = N->out;
+			break;
+		}
+	}
+	if (end) {
+		return d->next[c] = &unmatched;
+	}
+	/* Match may start anywhere */
+	D->list[n++] = A->start;
+	qsort(D->list, n, sizeof(int), cmp_int);
+	for (i = j = 1; i < n; i++) {
+		if (D->list[i] != D->list[j-1]) D->list[j++] = D->list[i];
+	}
+	if (D->size >= DFA_MEM) {
+		dfa_flush(D);
+		return intern(D, D->list, j, A->newline && b == '\n');
+	}
+	if ((t = intern(D, D->list, j, A->newline && b == '\n'))) {
+		d->next[c] = t;
+	}
+	return t;
+}
+
+/* Returns 1 if regex matches anywhere in s, 0 if not, -1 if out of memory */
+int dfa_match(dfa *D, const char *s, size_t n)
+{
+	const unsigned char *p = (const unsigned char*)s, *e = p + n;
+	const unsigned char *cls = D->A->cls;
+	dstate *d, *t;
+
+	if (!D->init && !(D->init = intern(D, &D->A->start, 1, 1))) {
+		return -1;
+	}
+	for (d = D->init; p < e; p++, d = t) {
+		if (!(t = d->next[cls[*p]]) && !(t = step(D, d, cls[*p]))) {
+			return -1;
+		}
+		if (t == &matched) {
+			return 1;
+		}
+	}
+	if (!(t = d->next[D->A->ncls]) && !(t = step(D, d, D->A->ncls))) {
+		return -1;
+	}
+	return t == &matched;
+}
@@ -0,0 +1,102 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DFA_H
+#define DFA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "corpus.h"
+#include "search.h"
+
+/* Patterns bigger than this are left to regexec() */
+#define NFA_MAX 16384
+
+/* States of one dfa are dropped and built again past this size */
+#define DFA_MEM (4*1024*1024)
+#define DFA_HASH 4096
+
+/* Strings every match contains are looked for first, up to this long */
+#define LIT_MAX 32
+#define NFA_LITS 3
+
+enum {
+	N_SET, /* byte in set */
+	N_SPLIT,
+	N_BOL,
+	N_EOL,
+	N_MATCH,
+};
+
+typedef struct nnode {
+	unsigned char op;
+	int out, out1; /* out1 only for N_SPLIT */
+	int set;
+} nnode;
+
+/*
+ * Regex compiled to a Thompson NFA. Bytes that no set tells apart share
+ * a class. Class ncls is the end of text.
+ */
+typedef struct nfa {
+	nnode *N;
+	int n, cap;
+	uint32_t (*set)[8];
+	int sets, setcap;
+	int start;
+	_Bool newline;
+	unsigned char cls[256];
+	unsigned char rep[256]; /* Some byte of each class */
+	int ncls;
+	needle lit[NFA_LITS]; /* longest first */
+	int lits;
+} nfa;
+
+/* Set of NFA states, reached after some input */
+typedef struct dstate {
+	struct dstate *hnext;
+	unsigned hash;
+	_Bool bol; /* at the start of a line */
+	int n;
+	int *pc;
+	struct dstate *next[]; /* ncls+1, built when first taken */
+} dstate;
+
+/* DFA of an nfa built lazily while matching. One for each thread. */
+typedef struct dfa {
+	nfa *A;
+	arena mem;
+	size_t size;
+	dstate *hash[DFA_HASH];
+	dstate *init;
+	int *stack, *list, *mark, gen;
+} dfa;
+
+int nfa_compile(nfa*, const char*, int);
+_Bool nfa_prefilter(nfa*, char*, size_t);
+void nfa_free(nfa*);
+int dfa_init(dfa*, nfa*);
+int dfa_match(dfa*, const char*, size_t);
+void dfa_free(dfa*);
+
+#endif
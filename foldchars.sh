@@ -0,0 +1,143 @@
+#!/usr/bin/sh
+# Copyright (c) 2019 Michał Czarnecki
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+# This stript downloads and parses this file:
+# http://www.unicode.org/Public/UCD/latest/ucd/UnicodeData.txt
+# in order to generate tables of lower case of letters, their base letters
+# without diacritics, and combining marks.
+
+# Files listed above belong to Unicode. You can find the license here:
+# http://www.unicode.org/copyright.html
+# or here:
+# http://www.unicode.org/terms_of_use.html
+
+# To generate new 'foldchars.h':
+# $ ./foldchars.sh > foldchars.h
+# or from a local copy:
+# $ UCD=file:///path/to/UnicodeData.txt ./foldchars.sh > foldchars.h
+
+UCD=${UCD:-http://www.unicode.org/Public/UCD/latest/ucd/UnicodeData.txt}
+
+echo "/*
+* This file was generated by a script using this file:
+* http://www.unicode.org/Public/UCD/latest/ucd/UnicodeData.txt
+* It belongs to Unicode. You can find the license here:
+* http://www.unicode.org/copyright.html
+* or here:
+* http://www.unicode.org/terms_of_use.html
+*/
+
+#ifndef FOLDCHARS_H
+#define FOLDCHARS_H
+"
+# Lower case is the simple lower case mapping.
+# Base letter follows canonical decompositions, and names of letters
+# that have none, like 'LATIN SMALL LETTER L WITH STROKE'.
+# Mappings to characters longer in UTF-8 are left out.
+curl -s "$UCD" | awk -F ';' '
+function hex(s,  i, n) {
+	for (n = i = 0; i < length(s); i++) {
+		n = n*16 + index("0123456789ABCDEF", substr(s, i+1, 1)) - 1
+	}
+	return n
+}
+function len(s,  c) {
+	c = hex(s)
+	return c < 128 ? 1 : c < 2048 ? 2 : c < 65536 ? 3 : 4
+}
+function lower(c) {
+	return (c in low) && len(low[c]) <= len(c) ? low[c] : c
+}
+function base(c,  w) {
+	for (;;) {
+		w = index(name[c], " WITH ")
+		if (c in dec) {
+			c = dec[c]
+		}
+		else if (w && (substr(name[c], 1, w-1) in code)) {
+			c = code[substr(name[c], 1, w-1)]
+		}
+		else {
+			return c
+		}
+	}
+}
+{
+	cp[++n] = $1
+	name[$1] = $2
+	code[$2] = $1
+	cat[$1] = $3
+	if ($6 != "" && $6 !~ /^</) {
+		split($6, d, " ")
+		dec[$1] = d[1]
+	}
+	if ($14 != "") {
+		low[$1] = $14
+	}
+}
+END {
+	print "/* A sorted list of Unicode codepoints and their lower case */"
+	print "static const int fold_case[][2] = {"
+	for (i = 1; i <= n; i++) {
+		if (lower(cp[i]) != cp[i]) {
+			print "{0x" cp[i] ", 0x" lower(cp[i]) "},"
+		}
+	}
+	print "};"
+	print "static const size_t fold_case_len = sizeof(fold_case)/sizeof(fold_case[0]);"
+	print ""
+	print "/*"
+	print " * A sorted list of Unicode codepoints of letters with diacritics"
+	print " * and their base letters in lower case"
+	print " */"
+	print "static const int fold_base[][2] = {"
+	for (i = 1; i <= n; i++) {
+		c = cp[i]
+		b = lower(base(c))
+		if (cat[c] ~ /^L/ && cat[b] ~ /^L/ && b != lower(c) && len(b) <= len(c)) {
+			print "{0x" c ", 0x" b "},"
+		}
+	}
+	print "};"
+	print "static const size_t fold_base_len = sizeof(fold_base)/sizeof(fold_base[0]);"
+	print ""
+	print "/* A sorted list of ranges of Unicode codepoints of combining marks */"
+	print "static const int fold_marks[][2] = {"
+	a = z = -2
+	for (i = 1; i <= n; i++) {
+		if (cat[cp[i]] != "Mn") {
+			continue
+		}
+		c = hex(cp[i])
+		if (c != z+1) {
+			if (a >= 0) {
+				printf "{0x%X, 0x%X},\n", a, z
+			}
+			a = c
+		}
+		z = c
+	}
+	printf "{0x%X, 0x%X},\n", a, z
+	print "};"
+	print "static const size_t fold_marks_len = sizeof(fold_marks)/sizeof(fold_marks[0]);"
+}'
+echo "#endif"
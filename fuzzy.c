@@ -0,0 +1,205 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Fuzzy matching: query matches if its characters appear in the entry
+ * in the same order. Score rewards matches at word boundaries and runs of
+ * consecutive characters, and penalizes gaps between them.
+ */
+
+#include "fuzzy.h"
+#include <string.h>
+
+typedef enum {
+	C_DELIM = 0, /* space, '_', '-', '.', ... */
+	C_PATH, /* '/' */
+	C_LOWER,
+	C_UPPER,
+	C_DIGIT,
+	C_OTHER, /* Bytes of UTF-8 sequences */
+} cclass;
+
+static cclass class_of(unsigned char c)
+{
+	if ('a' <= c && c <= 'z') return C_LOWER;
+	if ('A' <= c && c <= 'Z') return C_UPPER;
+	if ('0' <= c && c <= '9') return C_DIGIT;
+	if (c == '/') return C_PATH;
+	if (c >= 0x80) return C_OTHER;
+	return C_DELIM;
+}
+
+static unsigned char lower(unsigned char c)
+{
+	return 'A' <= c && c <= 'Z' ? c | 0x20 : c;
+}
+
+static int bonus(cclass prev, cclass cur)
+{
+	if (cur == C_DELIM || cur == C_PATH) return 0;
+	if (prev == C_PATH) return BONUS_PATH;
+	if (prev == C_DELIM) return BONUS_BOUNDARY;
+	if (prev == C_LOWER && cur == C_UPPER) return BONUS_CAMEL;
+	if (prev != C_DIGIT && cur == C_DIGIT) return BONUS_CAMEL;
+	return 0;
+}
+
+/* First occurence of c in [s, e). Query characters are already lower case. */
+static const char *find(const char *s, const char *e, unsigned char c, _Bool icase)
+{
+	const char *a, *b;
+
+	if (!icase || c < 'a' || 'z' < c) {
+		return memchr(s, c, e-s);
+	}
+	a = memchr(s, c, e-s);
+	b = memchr(s, c ^ 0x20, (a ? a : e) - s);
+	return b ? b : a;
+}
+
+/* Cheap test whether q (m bytes) is a subsequence of s (n bytes) */
+_Bool fuzzy_prefilter(const char *q, size_t m, const char *s, size_t n, _Bool icase)
+{
+	const char *e = s+n;
+	size_t j;
+
+	for (j = 0; j < m; j++) {
+		if (!(s = find(s, e, q[j], icase))) {
+			return 0;
+		}
+		s++;
+	}
+	return 1;
+}
+
+/*
+ * Finds window [*start, *end] of s (n bytes) where q (m > 0 bytes) is
+ * matched, as described at fuzzy_score(). Returns 0 if there is none.
+ */
+static _Bool window(const char *q, size_t m, const char *s, const char *f, size_t n,
+	_Bool icase, size_t *start, size_t *end)
+{
+	size_t i, j;
+	unsigned char c;
+
+	for (i = j = 0; i < n; i++) {
+		c = f ? (unsigned char)f[i] : icase ? lower(s[i]) : (unsigned char)s[i];
+		if (c == (unsigned char)q[j] && ++j == m) {
+			*end = i;
+			break;
+		}
+	}
+	if (j < m) {
+		return 0;
+	}
+	for (i = *end+1, j = m; i-- > 0;) {
+		c = f ? (unsigned char)f[i] : icase ? lower(s[i]) : (unsigned char)s[i];
+		if (c == (unsigned char)q[j-1] && --j == 0) {
+			*start = i;
+			break;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Returns score of q (m bytes) in s (n bytes) or -1 if it doesn't match.
+ * Scores of matches are never negative: gaps long enough to outweigh
+ * the matched characters make the worst score, 0.
+ * With icase q must be lower case. If f is s in lower case, q is compared
+ * with that instead.
+ * Like fzf v1: the first occurence of the subsequence is found, then
+ * shortened from the left by matching backwards from its end,
+ * then that window is scored.
+ */
+int fuzzy_score(const char *q, size_t m, const char *s, const char *f, size_t n, _Bool icase)
+{
+	size_t i, j, start = 0, end = 0;
+	int score = 0, b, run = 0, gap = 0;
+	unsigned char c;
+	cclass prev, cur;
+
+	if (!m) {
+		return 0;
+	}
+	if (!window(q, m, s, f, n, icase, &start, &end)) {
+		return -1;
+	}
+	prev = start ? class_of(s[start-1]) : C_PATH;
+	for (i = start, j = 0; i <= end; i++) {
+		c = f ? (unsigned char)f[i] : icase ? lower(s[i]) : (unsigned char)s[i];
+		cur = class_of(s[i]);
+		if (j < m && c == (unsigned char)q[j]) {
+			b = bonus(prev, cur);
+			if (run && b < BONUS_CONSECUTIVE) {
+				b = BONUS_CONSECUTIVE;
+			}
+			score += SCORE_MATCH + (j ? b : b*BONUS_FIRST_MULTIPLIER);
+			run++;
+			gap = 0;
+			j++;
+		}
+		else {
+			score += gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+			run = 0;
+			gap = 1;
+		}
+		prev = cur;
+	}
+	return score > 0 ? score : 0;
+}
+
+/*
+ * Sets pos to offsets of the m bytes of s that fuzzy_score() matched q with.
+ * Returns 0 if it doesn't match.
+ */
+_Bool fuzzy_pos(const char *q, size_t m, const char *s, const char *f, size_t n,
+	_Bool icase, size_t *pos)
+{
+	size_t i, j, start = 0, end = 0;
+	unsigned char c;
+
+	if (m && !window(q, m, s, f, n, icase, &start, &end)) {
+		return 0;
+	}
+	for (i = start, j = 0; j < m && i <= end; i++) {
+		c = f ? (unsigned char)f[i] : icase ? lower(s[i]) : (unsigned char)s[i];
+		if (c == (unsigned char)q[j]) {
+			pos[j++] = i;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Tells whether every entry matched by query b is matched by query a,
+ * that is whether a is a subsequence of b.
+ */
+_Bool fuzzy_refines(const char *a, const char *b, _Bool icase)
+{
+	for (; *a && *b; b++) {
+		if (icase ? lower(*a) == lower(*b) : *a == *b) {
+			a++;
+		}
+	}
+	return !*a;
+}
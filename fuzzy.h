@@ -0,0 +1,44 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stddef.h>
+
+#define SCORE_MATCH 16
+#define SCORE_GAP_START -3
+#define SCORE_GAP_EXTENSION -1
+/* Bonuses for a match at the start of a word */
+#define BONUS_PATH 10 /* after a '/' or at the start */
+#define BONUS_BOUNDARY 8 /* after a space, '_', '-', '.' and such */
+#define BONUS_CAMEL 7 /* lower case followed by upper case, or a digit */
+#define BONUS_CONSECUTIVE 4
+/* Bonus of the first character of the query counts this many times */
+#define BONUS_FIRST_MULTIPLIER 2
+
+_Bool fuzzy_prefilter(const char*, size_t, const char*, size_t, _Bool);
+int fuzzy_score(const char*, size_t, const char*, const char*, size_t, _Bool);
+_Bool fuzzy_pos(const char*, size_t, const char*, const char*, size_t, _Bool, size_t*);
+_Bool fuzzy_refines(const char*, const char*, _Bool);
+
+#endif
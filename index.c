@@ -0,0 +1,238 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "index.h"
+#include "set.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Most trigrams of a query looked up */
+#define QUERY_TRIGRAMS 256
+
+void index_init(tindex *I)
+{
+	memset(I, 0, sizeof(*I));
+}
+
+static _Bool quitting(tindex *I)
+{
+	_Bool q;
+
+	pthread_mutex_lock(&I->mx);
+	q = I->quit;
+	pthread_mutex_unlock(&I->mx);
+	return q;
+}
+
+/*
+ * Counts entries of each trigram into at, or lists them at post[at[t]].
+ * last[t] is 1 + the last entry of t, so that an entry is counted once
+ * however many times it has t.
+ * Returns -1 if told to quit.
+ */
+static int scan(tindex *I, uint32_t *last, uint32_t *at, _Bool fill)
+{
+	const unsigned char *cls = str_classes(), *p;
+	entry *e;
+	uint32_t t;
+	size_t j, n;
+	int k, f;
+
+	memset(last, 0, INDEX_TRIGRAMS * sizeof(uint32_t));
+	for (k = 0; k < I->num; k++) {
+		if (k % CORPUS_BLOCK == 0 && quitting(I)) {
+			return -1;
+		}
+		e = &I->C->blk[k/CORPUS_BLOCK][k%CORPUS_BLOCK];
+		/* Trigrams of folded copies too, if the corpus keeps them */
+		for (f = 0; f <= !!I->C->fold; f++) {
+			p = (const unsigned char*)(f ? CORPUS_FOLDED(I->C, e) : e->str);
+			n = f ? e->fL : e->L;
+			for (t = j = 0; j < n; j++) {
+				t = (t << 6 | cls[p[j]]) & (INDEX_TRIGRAMS-1);
+				if (j < 2 || last[t] == (uint32_t)k+1) {
+					continue;
+				}
+				last[t] = k+1;
+				if (fill) {
+					I->post[at[t]++] = k;
+				}
+				else {
+					at[t]++;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* Thread building the index. Postings are counted first, then filled. */
+static void *build(void *arg)
+{
+	tindex *I = arg;
+	uint32_t *last, *at;
+	size_t n = 0;
+	int t;
+
+	last = malloc(INDEX_TRIGRAMS * sizeof(uint32_t));
+	at = calloc(INDEX_TRIGRAMS, sizeof(uint32_t));
+	I->start = malloc((INDEX_TRIGRAMS+1) * sizeof(uint32_t));
+	if (!last || !at || !I->start || scan(I, last, at, 0)) {
+		goto fail;
+	}
+	for (t = 0; t < INDEX_TRIGRAMS; t++) {
+		I->start[t] = n;
+		n += at[t];
+		at[t] = I->start[t];
+		if (n > UINT32_MAX) {
+			goto fail;
+		}
+	}
+	I->start[t] = n;
+	I->size = (INDEX_TRIGRAMS+1 + n) * sizeof(uint32_t);
+	if (!n || I->size > I->max || !(I->post = malloc(n * sizeof(uint32_t)))
+	|| scan(I, last, at, 1)) {
+		goto fail;
+	}
+	goto done;
+fail:
+	free(I->start);
+	free(I->post);
+	I->start = I->post = 0;
+done:
+	free(last);
+	free(at);
+	pthread_mutex_lock(&I->mx);
+	I->built = 1;
+	pthread_mutex_unlock(&I->mx);
+	return 0;
+}
+
+/*
+ * Starts indexing what C has now, in the background, if it takes
+ * at most max bytes. C must not change while the index is in use.
+ * Returns 0 on success.
+ */
+int index_start(tindex *I, corpus *C, size_t max)
+{
+	I->C = C;
+	I->num = C->num;
+	I->max = max;
+	if (pthread_mutex_init(&I->mx, 0)) {
+		return -1;
+	}
+	if (pthread_create(&I->T, 0, build, I)) {
+		pthread_mutex_destroy(&I->mx);
+		return -1;
+	}
+	I->started = 1;
+	return 0;
+}
+
+/* Returns 1 once the index is built, unless it was too big */
+_Bool index_ready(tindex *I)
+{
+	_Bool b;
+
+	if (!I->started) {
+		return 0;
+	}
+	if (!I->joined) {
+		pthread_mutex_lock(&I->mx);
+		b = I->built;
+		pthread_mutex_unlock(&I->mx);
+		if (!b) {
+			return 0;
+		}
+		pthread_join(I->T, 0);
+		I->joined = 1;
+	}
+	return I->post != 0;
+}
+
+/*
+ * Lists in *cand, in input order, the indexed entries having all trigrams
+ * of the k strings s of lengths n. Lists of the rarest trigrams are
+ * intersected first.
+ * Returns number of candidates or -1 if all entries are to be tested,
+ * for want of a rare enough trigram or of memory.
+ */
+int index_find(tindex *I, const char **s, const size_t *n, int k, uint32_t **cand)
+{
+	const unsigned char *cls = str_classes(), *p;
+	uint32_t T[QUERY_TRIGRAMS], t, u, *C;
+	int nt = 0, i, j, m;
+	size_t x;
+
+	for (i = 0; i < k; i++) {
+		p = (const unsigned char*)s[i];
+		for (t = x = 0; x < n[i] && nt < QUERY_TRIGRAMS; x++) {
+			t = (t << 6 | cls[p[x]]) & (INDEX_TRIGRAMS-1);
+			if (x >= 2) {
+				T[nt++] = t;
+			}
+		}
+	}
+	if (!nt) {
+		return -1;
+	}
+	for (i = 1; i < nt; i++) {
+		u = T[i];
+		for (j = i; j > 0 && I->start[T[j-1]+1] - I->start[T[j-1]]
+		> I->start[u+1] - I->start[u]; j--) {
+			T[j] = T[j-1];
+		}
+		T[j] = u;
+	}
+	/* Looking up a common trigram costs more than a scan saves */
+	m = I->start[T[0]+1] - I->start[T[0]];
+	if (m > I->num / 4 || !(C = malloc((m ? m : 1) * sizeof(uint32_t)))) {
+		return -1;
+	}
+	memcpy(C, I->post + I->start[T[0]], m * sizeof(uint32_t));
+	for (i = 1; i < nt && m; i++) {
+		if (T[i] == T[i-1]) {
+			continue;
+		}
+		m = set_and(C, m, I->post + I->start[T[i]],
+			I->start[T[i]+1] - I->start[T[i]]);
+	}
+	*cand = C;
+	return m;
+}
+
+/* Stops building the index if it still is */
+void index_free(tindex *I)
+{
+	if (I->started && !I->joined) {
+		pthread_mutex_lock(&I->mx);
+		I->quit = 1;
+		pthread_mutex_unlock(&I->mx);
+		pthread_join(I->T, 0);
+	}
+	if (I->started) {
+		pthread_mutex_destroy(&I->mx);
+	}
+	free(I->start);
+	free(I->post);
+	memset(I, 0, sizeof(*I));
+}
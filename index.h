@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "corpus.h"
+
+/* Trigrams of character classes of str_mask(), 6 bits each */
+#define INDEX_TRIGRAMS (1 << 18)
+
+/*
+ * Inverted index of a corpus that doesn't change anymore.
+ * For each trigram, post[start[t], start[t+1]) are the entries
+ * that have it, in input order. It is built by a thread of its own.
+ */
+typedef struct tindex {
+	corpus *C;
+	int num; /* Entries indexed */
+	size_t max; /* Bytes the index may take */
+	size_t size; /* Bytes it takes, or would have taken if too big */
+	uint32_t *start, *post;
+	pthread_t T;
+	pthread_mutex_t mx;
+	_Bool started, built, joined, quit;
+} tindex;
+
+void index_init(tindex*);
+int index_start(tindex*, corpus*, size_t);
+_Bool index_ready(tindex*);
+int index_find(tindex*, const char**, const size_t*, int, uint32_t**);
+void index_free(tindex*);
+
+#endif
@@ -0,0 +1,1405 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _DEFAULT_SOURCE
+	#define _DEFAULT_SOURCE
+#endif
+
+#include "match.h"
+#include "fuzzy.h"
+#include "set.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Most strings a query gives the index to look up */
+#define INDEX_STRINGS 16
+
+/* When more than 1/RANK_ALL of a list is to be ranked, all of it is sorted */
+#define RANK_ALL 8
+
+/* Fewest entries a thread ranks */
+#define RANK_PART 16384
+
+/*
+ * Characters that can be appended to a regex without changing the meaning
+ * of what was there before. Appending them can only narrow the matches.
+ */
+static _Bool safe_to_append(unsigned char c)
+{
+	return !strchr("*+?{}[]()|\\^$", c);
+}
+
+/* Tells whether regex q matches only itself */
+static _Bool is_literal(char *q, int cflags)
+{
+	return !q[strcspn(q, cflags & REG_EXTENDED ? ".[]\\*^$+?{}()|" : ".[]\\*^$")];
+}
+
+/*
+ * Folds regex q of length L in place like str_fold() and returns its length.
+ * Escaped ASCII is kept, so that GNU escapes like \W keep their meaning.
+ * [:upper:] becomes [:lower:], which is all a folded copy has.
+ */
+static size_t regex_fold(char *q, size_t L, int how)
+{
+	size_t i = 0, j = 0, n;
+
+	while (i < L) {
+		if (q[i] == '\\' && i+1 < L && (unsigned char)q[i+1] < 0x80) {
+			q[j++] = q[i++];
+			q[j++] = q[i++];
+			continue;
+		}
+		if (L-i >= 9 && !memcmp(q+i, "[:upper:]", 9)) {
+			memcpy(q+j, "[:lower:]", 9);
+			i += 9;
+			j += 9;
+			continue;
+		}
+		for (n = 1; i+n < L && q[i+n] != '\\' && q[i+n] != '['; n++);
+		j += str_fold(q+j, q+i, n, how);
+		i += n;
+	}
+	return j;
+}
+
+/* Compares n bytes, ignoring case of ASCII letters if icase */
+static _Bool same(const char *a, const char *b, size_t n, _Bool icase)
+{
+	size_t i;
+
+	if (!icase) {
+		return !memcmp(a, b, n);
+	}
+	for (i = 0; i < n; i++) {
+		if (a[i] != b[i] && ((a[i] | 0x20) != (b[i] | 0x20)
+		|| (a[i] | 0x20) < 'a' || (a[i] | 0x20) > 'z')) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Returns 0 on success. There may be fewer threads than asked for. */
+int matcher_init(matcher *M, int threads)
+{
+	memset(M, 0, sizeof(*M));
+	pool_init(&M->P, threads);
+	if (!(M->S = calloc(M->P.threads, sizeof(mstate)))) {
+		return -1;
+	}
+	return 0;
+}
+
+static void state_free(matcher *M, mstate *S)
+{
+	int i;
+
+	for (i = 0; S->T && i < M->terms; i++) {
+		if (S->T[i].ok && !M->T[i].nfa) {
+			regfree(&S->T[i].R);
+		}
+		if (S->T[i].ok && M->T[i].nfa) {
+			dfa_free(&S->T[i].D);
+		}
+	}
+	free(S->T);
+	S->T = 0;
+	memset(&S->st, 0, sizeof(S->st));
+}
+
+static void terms_free(term *T, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		free(T[i].s);
+		needle_free(&T[i].N);
+		nfa_free(&T[i].A);
+		if (T[i].rok > 0) {
+			regfree(&T[i].R);
+		}
+	}
+	free(T);
+}
+
+/* Adds term s of length n to T. Returns 0 on success. */
+static int term_add(term **T, int *n, const char *s, size_t len,
+	enum term_kind kind, _Bool neg)
+{
+	term *t;
+
+	if (!(t = realloc(*T, (*n+1) * sizeof(term)))) {
+		return -1;
+	}
+	*T = t;
+	t += *n;
+	memset(t, 0, sizeof(*t));
+	if (!(t->s = malloc(len+1))) {
+		return -1;
+	}
+	memcpy(t->s, s, len);
+	t->s[len] = 0;
+	t->len = len;
+	t->kind = kind;
+	t->neg = neg;
+	(*n)++;
+	return 0;
+}
+
+/*
+ * Splits query q into terms. A query that isn't extended is one term.
+ * Terms of an extended one are separated by spaces, unless escaped:
+ *   'exact  ^prefix  suffix$  ^whole$  !not  this | or-that
+ * Other terms are fuzzy or regex, like the whole query would be,
+ * except that negated ones are exact rather than fuzzy.
+ * Returns number of terms or -1 if out of memory.
+ */
+static int parse_terms(const char *q, int cflags, term **T)
+{
+	char *b, *p;
+	size_t n;
+	int k = 0;
+	_Bool neg, exact, pre, suf, lit;
+	enum term_kind kind;
+
+	*T = 0;
+	if (!(cflags & M_EXTENDED)) {
+		if (!*q) {
+			return 0;
+		}
+		kind = cflags & M_FUZZY ? T_FUZZY
+			: is_literal((char*)q, cflags) ? T_EXACT : T_REGEX;
+		return term_add(T, &k, q, strlen(q), kind, 0) ? -1 : 1;
+	}
+	if (!(b = malloc(strlen(q)+1))) {
+		return -1;
+	}
+	while (*q) {
+		for (n = 0; *q && *q != ' '; q++) {
+			if (*q == '\\' && q[1] == ' ') {
+				q++;
+			}
+			b[n++] = *q;
+		}
+		for (; *q == ' '; q++);
+		b[n] = 0;
+		if (!strcmp(b, "|")) {
+			if (k) {
+				(*T)[k-1].or = 1;
+			}
+			continue;
+		}
+		p = b;
+		if ((neg = *p == '!')) {
+			p++;
+			n--;
+		}
+		if ((exact = *p == '\'')) {
+			p++;
+			n--;
+		}
+		pre = !exact && *p == '^';
+		suf = !exact && n > pre && p[n-1] == '$' && (n < 2 || p[n-2] != '\\');
+		/* In regex, ^ and $ mean the same, but the rest has to be literal */
+		p[n - suf] = 0;
+		lit = cflags & M_FUZZY || is_literal(p + pre, cflags);
+		if (pre + suf && lit) {
+			p += pre;
+			n -= pre + suf;
+			kind = pre && suf ? T_EQUAL : pre ? T_PREFIX : T_SUFFIX;
+		}
+		else {
+			p[n - suf] = suf ? '$' : 0;
+			kind = exact || (neg && cflags & M_FUZZY) ? T_EXACT
+				: cflags & M_FUZZY ? T_FUZZY : lit ? T_EXACT : T_REGEX;
+		}
+		if (n && term_add(T, &k, p, n, kind, neg)) {
+			free(b);
+			terms_free(*T, k);
+			*T = 0;
+			return -1;
+		}
+	}
+	free(b);
+	if (k) {
+		(*T)[k-1].or = 0;
+	}
+	return k;
+}
+
+/* Flags regex term T is compiled with. A folded copy has no case to ignore. */
+static int term_cflags(term *T, int cflags)
+{
+	return cflags & ~M_FLAGS & ~(T->folded ? REG_ICASE : 0);
+}
+
+static int term_cost(term *T)
+{
+	return T->kind == T_REGEX && !T->nfa ? T_REGEX+1 : (int)T->kind;
+}
+
+/* Group of terms ORed together, and how much it costs to test */
+typedef struct group {
+	int from, n, cost;
+	size_t len;
+} group;
+
+/* Cheaper first, then longer, which is likely rarer */
+static int group_cmp(const void *a, const void *b)
+{
+	const group *A = a, *B = b;
+
+	if (A->cost != B->cost) {
+		return A->cost - B->cost;
+	}
+	if (A->len != B->len) {
+		return A->len > B->len ? -1 : 1;
+	}
+	return A->from - B->from;
+}
+
+/*
+ * Orders terms so that entries are rejected as cheaply as possible:
+ * groups and terms within a group by cost.
+ * Returns 0 on success.
+ */
+static int terms_order(term *T, int n)
+{
+	group *G;
+	term *U, t;
+	int i, j, k, m, g = 0;
+
+	if (!(G = malloc(n * sizeof(group))) || !(U = malloc(n * sizeof(term)))) {
+		free(G);
+		return -1;
+	}
+	for (i = 0; i < n; i = j) {
+		G[g].from = i;
+		G[g].cost = 0;
+		G[g].len = T[i].len;
+		for (j = i; j < n; ) {
+			G[g].cost += term_cost(&T[j]);
+			if (!T[j++].or) break;
+		}
+		G[g++].n = j - i;
+	}
+	qsort(G, g, sizeof(group), group_cmp);
+	for (i = k = 0; i < g; i++) {
+		for (j = 0; j < G[i].n; j++) {
+			t = T[G[i].from + j];
+			for (m = k+j; m > k && term_cost(&U[m-1]) > term_cost(&t); m--) {
+				U[m] = U[m-1];
+			}
+			U[m] = t;
+		}
+		for (j = 0; j < G[i].n; j++) {
+			U[k+j].or = j < G[i].n-1;
+		}
+		k += G[i].n;
+	}
+	free(G);
+	memcpy(T, U, n * sizeof(term));
+	free(U);
+	return 0;
+}
+
+/* What every match requires, to rule out blocks and entries early */
+static void requirements(matcher *M)
+{
+	term *T;
+	int i, j;
+
+	M->mask = 0;
+	M->minL = 0;
+	memset(M->bigram, 0, sizeof(M->bigram));
+	M->bigrams = 0;
+	for (i = 0; i < M->terms; i++) {
+		T = &M->T[i];
+		if (T->neg || T->or || (i && T[-1].or)) {
+			continue;
+		}
+		if (T->kind == T_REGEX) {
+			for (j = 0; T->nfa && j < T->A.lits; j++) {
+				M->mask |= str_mask(T->A.lit[j].s, T->A.lit[j].n);
+				str_bigrams(T->A.lit[j].s, T->A.lit[j].n, M->bigram);
+				M->bigrams |= T->A.lit[j].n > 1;
+				if (T->A.lit[j].n > M->minL) {
+					M->minL = T->A.lit[j].n;
+				}
+			}
+			continue;
+		}
+		M->mask |= str_mask(T->s, T->len);
+		M->minL = T->len > M->minL ? T->len : M->minL;
+		/* Fuzzy matches need not have characters of s next to each other */
+		if (T->kind != T_FUZZY) {
+			str_bigrams(T->s, T->len, M->bigram);
+			M->bigrams |= T->len > 1;
+		}
+	}
+}
+
+/* Returns 0 on success */
+int matcher_compile(matcher *M, char *q, int cflags)
+{
+	term *T;
+	char *p;
+	int i, j, n;
+
+	for (i = 0; i < M->P.threads; i++) {
+		state_free(M, &M->S[i]);
+	}
+	terms_free(M->T, M->terms);
+	M->T = 0;
+	M->terms = 0;
+	free(M->query);
+	M->query = strdup(q);
+	M->cflags = cflags;
+	M->cands = 0;
+	if (M->sp) {
+		memset(M->sp, 0, SPAN_CACHE * sizeof(spans));
+	}
+	M->ok = M->query && 0 <= (n = parse_terms(q, cflags, &M->T));
+	M->terms = M->ok ? n : 0;
+	for (i = 0; i < M->terms && M->ok; i++) {
+		T = &M->T[i];
+		/* Case insensitive search of folded copies is case sensitive */
+		T->folded = M->fold && (cflags & REG_ICASE);
+		if (T->folded && T->kind == T_REGEX) {
+			T->len = regex_fold(T->s, T->len, M->fold);
+			T->s[T->len] = 0;
+		}
+		else if (T->folded) {
+			T->len = str_fold(T->s, T->s, T->len, M->fold);
+			T->s[T->len] = 0;
+		}
+		else if (T->kind == T_FUZZY && (cflags & REG_ICASE)) {
+			for (p = T->s; *p; p++) {
+				if ('A' <= *p && *p <= 'Z') *p |= 0x20;
+			}
+		}
+		if (T->kind == T_EXACT && needle_init(&T->N, T->s, T->len,
+			(cflags & REG_ICASE) && !T->folded)) {
+			M->ok = 0;
+		}
+		/* Patterns the nfa can't express are left to regexec() */
+		if (T->kind == T_REGEX) {
+			T->nfa = !nfa_compile(&T->A, T->s, term_cflags(T, cflags));
+		}
+	}
+	if (M->ok && terms_order(M->T, M->terms)) {
+		M->ok = 0;
+	}
+	for (i = 0; i < M->P.threads && M->ok; i++) {
+		if (!(M->S[i].T = calloc(M->terms + 1, sizeof(tstate)))) {
+			M->ok = 0;
+		}
+		for (j = 0; j < M->terms && M->ok; j++) {
+			T = &M->T[j];
+			if (T->kind != T_REGEX) {
+				continue;
+			}
+			if (T->nfa) {
+				M->S[i].T[j].ok = !dfa_init(&M->S[i].T[j].D, &T->A);
+			}
+			else {
+				M->S[i].T[j].ok = !regcomp(&M->S[i].T[j].R, T->s,
+					term_cflags(T, cflags) | REG_NOSUB);
+			}
+			M->ok = M->S[i].T[j].ok;
+		}
+	}
+	requirements(M);
+	return !M->ok;
+}
+
+/* Tells whether every entry that term b matches is matched by a */
+static _Bool term_refines(term *a, term *b, int cflags)
+{
+	needle N;
+	_Bool r;
+
+	if (a->neg || b->neg) {
+		return a->neg == b->neg && a->kind == b->kind && !strcmp(a->s, b->s);
+	}
+	switch (a->kind) {
+	case T_EQUAL:
+		return b->kind == T_EQUAL && !strcmp(a->s, b->s);
+	case T_PREFIX:
+		return (b->kind == T_PREFIX || b->kind == T_EQUAL)
+			&& !strncmp(a->s, b->s, a->len);
+	case T_SUFFIX:
+		return (b->kind == T_SUFFIX || b->kind == T_EQUAL)
+			&& b->len >= a->len && !strcmp(a->s, b->s + b->len - a->len);
+	case T_EXACT:
+		if (b->kind > T_EXACT) {
+			return 0;
+		}
+		if (needle_init(&N, a->s, a->len, cflags & REG_ICASE)) {
+			return 0;
+		}
+		r = needle_find(&N, b->s, b->len) != 0;
+		needle_free(&N);
+		return r;
+	case T_FUZZY:
+		return b->kind == T_FUZZY && fuzzy_refines(a->s, b->s, cflags & REG_ICASE);
+	case T_REGEX:
+		return b->kind == T_REGEX
+			&& query_refines(a->s, cflags & ~M_EXTENDED, b->s, cflags & ~M_EXTENDED);
+	}
+	return 0;
+}
+
+/*
+ * Tells whether every entry matching q also matches valid query o,
+ * so that only previous matches have to be tested against q.
+ * For regex that's the case when q is the old query with plain characters
+ * appended. For fuzzy query, when the old one is a subsequence of q.
+ * For extended query, when each term of o is narrowed by the term of q
+ * in its place, q may have more, and nothing is ORed.
+ */
+_Bool query_refines(char *o, int ocflags, char *q, int cflags)
+{
+	term *A, *B;
+	needle N;
+	size_t n;
+	char last;
+	int a, b, i;
+	_Bool r;
+
+	if (ocflags != cflags) {
+		return 0;
+	}
+	if (cflags & M_EXTENDED) {
+		a = parse_terms(o, cflags, &A);
+		b = parse_terms(q, cflags, &B);
+		r = 0 <= a && a <= b;
+		for (i = 0; r && i < a; i++) {
+			r = !A[i].or && term_refines(&A[i], &B[i], cflags);
+		}
+		for (i = 0; r && i < b; i++) {
+			r = !B[i].or;
+		}
+		terms_free(A, a > 0 ? a : 0);
+		terms_free(B, b > 0 ? b : 0);
+		return r;
+	}
+	if (cflags & M_FUZZY) {
+		return fuzzy_refines(o, q, cflags & REG_ICASE);
+	}
+	if (is_literal(o, cflags) && is_literal(q, cflags)) {
+		/* New query must contain the old one */
+		if (needle_init(&N, o, strlen(o), cflags & REG_ICASE)) {
+			return 0;
+		}
+		r = needle_find(&N, q, strlen(q)) != 0;
+		needle_free(&N);
+		return r;
+	}
+	n = strlen(o);
+	if (strncmp(o, q, n) || strchr(o, '|')) {
+		return 0;
+	}
+	last = n ? o[n-1] : 0;
+	if (last == '\\' || last == '$') {
+		return 0;
+	}
+	for (q += n; *q; q++) {
+		if (!safe_to_append(*q)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Sums prefilter counters of all threads */
+void matcher_stats(matcher *M, mstats *st)
+{
+	int i;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < M->P.threads; i++) {
+		st->tested += M->S[i].st.tested;
+		st->skipped += M->S[i].st.skipped;
+		st->indexed += M->S[i].st.indexed;
+		st->masked += M->S[i].st.masked;
+		st->filtered += M->S[i].st.filtered;
+	}
+}
+
+/* From now on entries that I covers are looked up in it first */
+void matcher_index(matcher *M, tindex *I)
+{
+	M->I = I;
+	M->cands = 0;
+}
+
+/* Entries to be matched have copies str_fold()ed as fold says, if any */
+void matcher_fold(matcher *M, int fold)
+{
+	M->fold = fold;
+}
+
+/* Asks the index which entries may match, if the query requires literals */
+static void candidates(matcher *M)
+{
+	const char *s[INDEX_STRINGS];
+	size_t n[INDEX_STRINGS];
+	term *T;
+	int i, j, k = 0;
+
+	free(M->cand);
+	M->cand = 0;
+	M->ncand = -1;
+	M->cands = 1;
+	if (!M->ok) {
+		return;
+	}
+	for (i = 0; i < M->terms; i++) {
+		T = &M->T[i];
+		if (T->neg || T->or || (i && T[-1].or) || T->kind == T_FUZZY) {
+			continue;
+		}
+		if (T->kind != T_REGEX && k < INDEX_STRINGS) {
+			s[k] = T->s;
+			n[k++] = T->len;
+		}
+		for (j = 0; T->nfa && j < T->A.lits && k < INDEX_STRINGS; j++) {
+			s[k] = T->A.lit[j].s;
+			n[k++] = T->A.lit[j].n;
+		}
+	}
+	if (k) {
+		M->ncand = index_find(M->I, s, n, k, &M->cand);
+	}
+}
+
+void matcher_free(matcher *M)
+{
+	int i;
+
+	/* Before the pool, which forgets how many threads there were */
+	for (i = 0; M->S && i < M->P.threads; i++) {
+		state_free(M, &M->S[i]);
+		free(M->S[i].line);
+	}
+	pool_free(&M->P);
+	terms_free(M->T, M->terms);
+	free(M->S);
+	free(M->J);
+	free(M->H);
+	free(M->sp);
+	free(M->cand);
+	free(M->query);
+	memset(M, 0, sizeof(*M));
+}
+
+/* Returns L bytes at s of e terminated, if need be in a copy, or 0 */
+static char *terminated(mstate *S, corpus *C, entry *e, char *s, size_t L)
+{
+	if (!C->map && s + L == e->str + e->L) {
+		return s;
+	}
+	/* Mapped entries and fields are not terminated */
+	if (L >= S->lines) {
+		free(S->line);
+		S->lines = L+1;
+		if (!(S->line = malloc(S->lines))) {
+			S->lines = 0;
+			return 0;
+		}
+	}
+	memcpy(S->line, s, L);
+	S->line[L] = 0;
+	return S->line;
+}
+
+/*
+ * Returns score of e for term i, or -1 if it doesn't match.
+ * Only L bytes at s, the matched fields of e, are looked at.
+ */
+static int term_score(matcher *M, mstate *S, int i, corpus *C, entry *e, char *s, size_t L)
+{
+	term *T = &M->T[i];
+	_Bool icase = (M->cflags & REG_ICASE) && !T->folded;
+	char *f = T->folded ? CORPUS_FOLDED(C, e) : s;
+	size_t n = T->folded ? e->fL : L;
+	int r = -1;
+
+	switch (T->kind) {
+	case T_EQUAL:
+		r = n == T->len && same(f, T->s, T->len, icase) ? 0 : -1;
+		break;
+	case T_PREFIX:
+		r = n >= T->len && same(f, T->s, T->len, icase) ? 0 : -1;
+		break;
+	case T_SUFFIX:
+		r = n >= T->len && same(f + n - T->len, T->s, T->len, icase) ? 0 : -1;
+		break;
+	case T_EXACT:
+		r = needle_find(&T->N, f, n) ? 0 : -1;
+		break;
+	case T_FUZZY:
+		/*
+		 * A copy as long as the entry has every character as long,
+		 * so character classes for the score are those of the entry
+		 */
+		if (!fuzzy_prefilter(T->s, T->len, f, n, icase)) {
+			break;
+		}
+		if (f != s && n == L) {
+			r = fuzzy_score(T->s, T->len, s, f, n, 0);
+		}
+		else {
+			r = fuzzy_score(T->s, T->len, f, 0, n, icase);
+		}
+		break;
+	case T_REGEX:
+		if (T->nfa) {
+			if (!nfa_prefilter(&T->A, f, n)) {
+				S->st.filtered += !T->neg;
+			}
+			else {
+				r = dfa_match(&S->T[i].D, f, n) > 0 ? 0 : -1;
+			}
+			break;
+		}
+		if (!(f = terminated(S, C, e, f, n))) {
+			return -1;
+		}
+		r = regexec(&S->T[i].R, f, 0, 0, 0) ? -1 : 0;
+		break;
+	}
+	if (T->neg) {
+		return r < 0 ? 0 : -1;
+	}
+	return r;
+}
+
+/*
+ * Returns score of entry k or -1 if it doesn't match.
+ * Every group of terms must have one that matches. Scores add up.
+ */
+static int state_score(matcher *M, mstate *S, corpus *C, uint32_t k)
+{
+	entry *e = CORPUS_AT(C, k);
+	char *p = e->str;
+	size_t L = e->L;
+	uint32_t *sp;
+	int i = 0, r, s = 0;
+
+	if (!M->ok) {
+		return -1;
+	}
+	if (C->split) {
+		sp = CORPUS_FIELDS(C, k);
+		p += sp[0];
+		L = sp[1];
+	}
+	while (i < M->terms) {
+		r = -1;
+		do {
+			if (r < 0) {
+				r = term_score(M, S, i, C, e, p, L);
+			}
+		} while (M->T[i++].or);
+		if (r < 0) {
+			return -1;
+		}
+		s += r;
+	}
+	return s;
+}
+
+/* Scores are kept only if they can differ */
+static _Bool scored(matcher *M)
+{
+	int i;
+
+	for (i = 0; i < M->terms; i++) {
+		if (M->T[i].kind == T_FUZZY && !M->T[i].neg) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void mlist_init(mlist *L)
+{
+	memset(L, 0, sizeof(*L));
+}
+
+/* Makes room for n entries, and their scores if S. Returns 0 on success. */
+int mlist_reserve(mlist *L, int n, _Bool S)
+{
+	uint32_t *E;
+	int *s, cap;
+
+	if (n+1 <= L->cap && (!S || L->S)) {
+		return 0;
+	}
+	cap = n+1 > 2*L->cap ? n+1 : 2*L->cap;
+	if (!(E = realloc(L->E, cap * sizeof(uint32_t)))) {
+		return -1;
+	}
+	L->E = E;
+	if (S) {
+		if (!(s = realloc(L->S, cap * sizeof(int)))) {
+			return -1;
+		}
+		L->S = s;
+	}
+	L->cap = cap;
+	return 0;
+}
+
+typedef struct rank {
+	int score, i;
+} rank;
+
+/* Tells whether position a of L goes before b: better, or as good and first */
+static _Bool better(mlist *L, int a, int b)
+{
+	return L->S[a] > L->S[b] || (L->S[a] == L->S[b] && a < b);
+}
+
+static int rank_cmp(const void *a, const void *b)
+{
+	const rank *A = a, *B = b;
+
+	if (A->score != B->score) {
+		return A->score > B->score ? -1 : 1;
+	}
+	return A->i - B->i;
+}
+
+/* Adds bytes [a, b) to spans H, joined with the last if they touch */
+static void span_add(spans *H, size_t a, size_t b)
+{
+	mspan *p = H->S + H->n;
+
+	if (a >= b) {
+		return;
+	}
+	if (H->n && p[-1].off + p[-1].len == a) {
+		p[-1].len += b - a;
+	}
+	else if (H->n < SPAN_MAX) {
+		H->S[H->n].off = a;
+		H->S[H->n].len = b - a;
+		H->n++;
+	}
+}
+
+static int span_cmp(const void *a, const void *b)
+{
+	const mspan *x = a, *y = b;
+
+	return (x->off > y->off) - (x->off < y->off);
+}
+
+/*
+ * Sets *S to spans of entry k that terms of the query matched,
+ * sorted and not overlapping, and returns how many there are.
+ * Meant for entries being drawn, so they are found as needed,
+ * by the calling thread while nothing is being matched,
+ * and kept until the query changes.
+ */
+int entry_spans(matcher *M, corpus *C, uint32_t k, const mspan **S)
+{
+	entry *e = CORPUS_AT(C, k);
+	mstate *st = &M->S[0];
+	spans *H;
+	term *T;
+	regmatch_t m;
+	char *s = e->str, *f;
+	size_t L = e->L, n, b = 0, a, z, *pos;
+	uint32_t *sp;
+	_Bool icase;
+	int i, j;
+
+	*S = 0;
+	if (!M->ok || (!M->sp && !(M->sp = calloc(SPAN_CACHE, sizeof(spans))))) {
+		return 0;
+	}
+	H = &M->sp[k % SPAN_CACHE];
+	*S = H->S;
+	if (H->id == k+1) {
+		return H->n;
+	}
+	H->id = k+1;
+	H->n = 0;
+	if (C->split) {
+		sp = CORPUS_FIELDS(C, k);
+		b = sp[0];
+		s += b;
+		L = sp[1];
+	}
+	for (i = 0; i < M->terms; i++) {
+		T = &M->T[i];
+		if (T->neg || term_score(M, st, i, C, e, s, L) < 0) {
+			continue;
+		}
+		icase = (M->cflags & REG_ICASE) && !T->folded;
+		f = T->folded ? CORPUS_FOLDED(C, e) : s;
+		n = T->folded ? e->fL : L;
+		a = z = 0;
+		switch (T->kind) {
+		case T_EQUAL:
+			z = n;
+			break;
+		case T_PREFIX:
+			z = T->len;
+			break;
+		case T_SUFFIX:
+			a = n - T->len;
+			z = n;
+			break;
+		case T_EXACT:
+			a = needle_find(&T->N, f, n) - f;
+			z = a + T->len;
+			break;
+		case T_FUZZY:
+			/* Each matched byte, in the entry if the copy differs */
+			if (!(pos = malloc(T->len * sizeof(size_t)))) {
+				break;
+			}
+			if (fuzzy_pos(T->s, T->len, f, 0, n, icase, pos)) {
+				for (j = 0; j < (int)T->len; j++) {
+					a = T->folded ? str_unfold(s, L, pos[j], M->fold) : pos[j];
+					z = T->folded ? str_unfold(s, L, pos[j]+1, M->fold) : pos[j]+1;
+					span_add(H, b + a, b + z);
+				}
+			}
+			free(pos);
+			a = z = 0;
+			break;
+		case T_REGEX:
+			if (!T->rok) {
+				T->rok = regcomp(&T->R, T->s, term_cflags(T, M->cflags)) ? -1 : 1;
+			}
+			if (T->rok > 0 && (f = terminated(st, C, e, f, n))
+			&& !regexec(&T->R, f, 1, &m, 0)) {
+				a = m.rm_so;
+				z = m.rm_eo;
+			}
+			break;
+		}
+		if (T->folded && T->kind != T_FUZZY) {
+			a = str_unfold(s, L, a, M->fold);
+			z = str_unfold(s, L, z, M->fold);
+		}
+		span_add(H, b + a, b + z);
+	}
+	/* Spans of different terms may be out of order or overlap */
+	qsort(H->S, H->n, sizeof(mspan), span_cmp);
+	for (i = j = 0; i < H->n; i++) {
+		if (j && H->S[j-1].off + H->S[j-1].len >= H->S[i].off) {
+			z = H->S[i].off + H->S[i].len;
+			if (z > H->S[j-1].off + H->S[j-1].len) {
+				H->S[j-1].len = z - H->S[j-1].off;
+			}
+		}
+		else {
+			H->S[j++] = H->S[i];
+		}
+	}
+	H->n = j;
+	return j;
+}
+
+/*
+ * Returns index in the corpus of i-th entry to be shown, counting from 1,
+ * or -1 if there is none.
+ * Of a scored list, only as many as entry_rank() was asked for.
+ */
+int mlist_id(mlist *L, int i)
+{
+	if (i < 1 || i > (L->S ? L->ranked : L->n)) {
+		return -1;
+	}
+	return L->E[L->S ? L->R[i-1] : i-1];
+}
+
+/* Returns i-th entry to be shown, like mlist_id(), or 0 */
+entry *mlist_at(mlist *L, corpus *C, int i)
+{
+	int k = mlist_id(L, i);
+
+	return k < 0 ? 0 : CORPUS_AT(C, k);
+}
+
+void mlist_free(mlist *L)
+{
+	free(L->E);
+	free(L->R);
+	free(L->S);
+	memset(L, 0, sizeof(*L));
+}
+
+static int jobs_alloc(matcher *M, int jobs)
+{
+	mjob *J;
+
+	if (jobs > M->jobs) {
+		if (!(J = realloc(M->J, jobs * sizeof(mjob)))) {
+			return -1;
+		}
+		M->J = J;
+		M->jobs = jobs;
+	}
+	return 0;
+}
+
+/* Moves results of all jobs together after what L had, keeping order */
+static int jobs_gather(matcher *M, int jobs, mlist *L)
+{
+	uint32_t *E = L->E+L->n;
+	int *S = L->S ? L->S+L->n : 0;
+	int j, n = 0;
+
+	for (j = 0; j < jobs; j++) {
+		memmove(E+n, E+M->J[j].off, M->J[j].n * sizeof(uint32_t));
+		if (S) {
+			memmove(S+n, S+M->J[j].off, M->J[j].n * sizeof(int));
+		}
+		n += M->J[j].n;
+	}
+	L->n += n;
+	return n;
+}
+
+/* Adds entry k to output of job J if it matches */
+static void job_test(matcher *M, mjob *J, int t, uint32_t k, int off)
+{
+	int s;
+
+	if (0 <= (s = state_score(M, &M->S[t], M->C, k))) {
+		M->out->E[M->out->n+off+J->n] = k;
+		if (M->out->S) {
+			M->out->S[M->out->n+off+J->n] = s;
+		}
+		J->n++;
+	}
+}
+
+/* Returns 0 if no entry of a block with summary S can match */
+static _Bool block_may_match(matcher *M, summary *S)
+{
+	int i;
+
+	if ((S->mask & M->mask) != M->mask || S->maxL < M->minL) {
+		return 0;
+	}
+	for (i = 0; M->bigrams && i < 64; i++) {
+		if ((S->bigram[i] & M->bigram[i]) != M->bigram[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Job j matches corpus block of index from/CORPUS_BLOCK + j */
+static void match_job(void *arg, int j, int t)
+{
+	matcher *M = arg;
+	mjob *J = &M->J[j];
+	uint64_t *K, q = M->mask;
+	uint32_t *c, *end;
+	int b, i, e, x, n = 0;
+
+	b = M->from/CORPUS_BLOCK + j;
+	K = M->C->mask[b];
+	i = j ? 0 : M->from%CORPUS_BLOCK;
+	e = M->to - b*CORPUS_BLOCK;
+	if (e > CORPUS_BLOCK) e = CORPUS_BLOCK;
+	J->off = b*CORPUS_BLOCK + i - M->from;
+	J->len = e - i;
+	J->n = 0;
+	M->S[t].st.tested += J->len;
+	/* Blocks are summarized only once a query requires something */
+	if (M->mask || M->minL) {
+		corpus_summarize(M->C, b);
+		if (!block_may_match(M, &M->C->sum[b])) {
+			M->S[t].st.skipped += J->len;
+			return;
+		}
+	}
+	/* Of indexed entries only those having all trigrams are looked at */
+	if (M->I && M->ncand >= 0 && b*CORPUS_BLOCK + i < M->I->num) {
+		x = M->I->num - b*CORPUS_BLOCK < e ? M->I->num - b*CORPUS_BLOCK : e;
+		end = M->cand + M->ncand;
+		c = set_gallop(M->cand, end, b*CORPUS_BLOCK + i);
+		for (n = x - i; c < end && (int)*c < b*CORPUS_BLOCK + x; c++) {
+			job_test(M, J, t, *c, J->off);
+			n--;
+		}
+		M->S[t].st.indexed += n;
+		n = 0;
+		i = x;
+	}
+	/* Entries lacking a character of the query are not looked at */
+	for (; i < e; i++) {
+		if ((K[i] & q) == q) {
+			job_test(M, J, t, b*CORPUS_BLOCK + i, J->off);
+		}
+		else {
+			n++;
+		}
+	}
+	M->S[t].st.masked += n;
+}
+
+/*
+ * Job j filters entries [j*CORPUS_BLOCK, (j+1)*CORPUS_BLOCK) of the input,
+ * counting from 'from'
+ */
+static void refine_job(void *arg, int j, int t)
+{
+	matcher *M = arg;
+	mjob *J = &M->J[j];
+	uint32_t *P;
+	int i;
+
+	J->off = j*CORPUS_BLOCK;
+	P = M->in->E + M->from + J->off;
+	for (i = J->n = 0; i < J->len; i++) {
+		job_test(M, J, t, P[i], J->off);
+	}
+	M->S[t].st.tested += J->len;
+}
+
+/*
+ * Appends entries of corpus [from, to) that match to L.
+ * Blocks are matched in parallel.
+ * Returns number of entries appended or -1 if out of memory.
+ */
+int entry_match(matcher *M, corpus *C, int from, int to, mlist *L)
+{
+	int jobs;
+
+	if (mlist_reserve(L, L->n + to - from, scored(M))) {
+		return -1;
+	}
+	if (from >= to) {
+		return 0;
+	}
+	jobs = (to-1)/CORPUS_BLOCK - from/CORPUS_BLOCK + 1;
+	if (jobs_alloc(M, jobs)) {
+		return -1;
+	}
+	M->C = C;
+	M->from = from;
+	M->to = to;
+	M->out = L;
+	if (M->I && !M->cands) {
+		candidates(M);
+	}
+	pool_run(&M->P, match_job, M, jobs);
+	return jobs_gather(M, jobs, L);
+}
+
+/*
+ * Appends entries [from, to) of P that match to L.
+ * Returns number of entries appended or -1 if out of memory.
+ */
+int entry_refine(matcher *M, corpus *C, mlist *P, int from, int to, mlist *L)
+{
+	int j, jobs = (to-from+CORPUS_BLOCK-1)/CORPUS_BLOCK;
+
+	if (mlist_reserve(L, L->n + to - from, scored(M)) || jobs_alloc(M, jobs)) {
+		return -1;
+	}
+	if (from >= to) {
+		return 0;
+	}
+	for (j = 0; j < jobs; j++) {
+		M->J[j].len = j == jobs-1 ? to - from - j*CORPUS_BLOCK : CORPUS_BLOCK;
+	}
+	M->C = C;
+	M->in = P;
+	M->from = from;
+	M->out = L;
+	pool_run(&M->P, refine_job, M, jobs);
+	return jobs_gather(M, jobs, L);
+}
+
+/* Adds position i of L to heap H of n, whose worst is at the top, if it is among k best */
+static void heap_add(mlist *L, int *H, int *n, int k, int i)
+{
+	int c, p, x;
+
+	if (*n == k) {
+		if (!better(L, i, H[0])) {
+			return;
+		}
+		/* The worst is replaced and sinks */
+		for (p = 0; (c = 2*p+1) < k; p = c) {
+			if (c+1 < k && better(L, H[c], H[c+1])) {
+				c++;
+			}
+			if (!better(L, i, H[c])) {
+				break;
+			}
+			H[p] = H[c];
+		}
+		H[p] = i;
+		return;
+	}
+	for (p = (*n)++; p && better(L, (x = H[(p-1)/2]), i); p = (p-1)/2) {
+		H[p] = x;
+	}
+	H[p] = i;
+}
+
+/* Job j keeps the k best of its part of the list in a heap */
+static void rank_job(void *arg, int j, int t)
+{
+	matcher *M = arg;
+	mjob *J = &M->J[j];
+	int i, *H = M->H + (size_t)j*M->k;
+
+	(void)t;
+	for (i = J->off, J->n = 0; i < J->off + J->len; i++) {
+		heap_add(M->out, H, &J->n, M->k, i);
+	}
+}
+
+/*
+ * Sorts all of L by score with radix sort, least significant byte first,
+ * so that ties keep input order. Scores are never negative.
+ * Returns 0 on success.
+ */
+static int rank_all(mlist *L)
+{
+	int *R, *T, *U, i, b, max = 0;
+	size_t c[256], sum, x;
+
+	if (!(R = malloc(L->n * sizeof(int) + 1))) {
+		return -1;
+	}
+	if (!(T = malloc(L->n * sizeof(int) + 1))) {
+		free(R);
+		return -1;
+	}
+	for (i = 0; i < L->n; i++) {
+		R[i] = i;
+		max = L->S[i] > max ? L->S[i] : max;
+	}
+	/* Key is max - score, so that the best go first */
+	for (b = 0; b < 32 && (unsigned)max >> b; b += 8) {
+		memset(c, 0, sizeof(c));
+		for (i = 0; i < L->n; i++) {
+			c[(unsigned)(max - L->S[R[i]]) >> b & 255]++;
+		}
+		for (sum = 0, i = 0; i < 256; i++) {
+			x = c[i];
+			c[i] = sum;
+			sum += x;
+		}
+		for (i = 0; i < L->n; i++) {
+			T[c[(unsigned)(max - L->S[R[i]]) >> b & 255]++] = R[i];
+		}
+		U = R;
+		R = T;
+		T = U;
+	}
+	free(T);
+	free(L->R);
+	L->R = R;
+	L->ranked = L->rn = L->n;
+	return 0;
+}
+
+/*
+ * Makes sure the k best of scored list L, or all of them if fewer,
+ * are ranked in R. Best go first, ties in input order.
+ * Entries added since the last time compete with the ones ranked then,
+ * each thread keeping the k best of a part in a heap. When most of
+ * the list is wanted, it is sorted all at once.
+ * Returns 0 on success.
+ */
+int entry_rank(matcher *M, mlist *L, int k)
+{
+	int from, jobs, part, j, n, m, *H, *R;
+	rank *K;
+
+	if (!L->S) {
+		return 0;
+	}
+	k = k < L->n ? k : L->n;
+	if (L->rn == L->n && L->ranked >= k) {
+		return 0;
+	}
+	if (!k) {
+		L->ranked = 0;
+		L->rn = L->n;
+		return 0;
+	}
+	if (k > L->n / RANK_ALL) {
+		return rank_all(L);
+	}
+	/* Deeper than ranked before, what was left out may get in */
+	from = L->ranked >= k || L->ranked == L->rn ? L->rn : 0;
+	part = (L->n - from + M->P.threads - 1) / M->P.threads;
+	part = part > RANK_PART ? part : RANK_PART;
+	jobs = (L->n - from + part - 1) / part;
+	if (jobs_alloc(M, jobs)) {
+		return -1;
+	}
+	if ((size_t)jobs * k > M->Hs) {
+		if (!(H = realloc(M->H, (size_t)jobs * k * sizeof(int)))) {
+			return -1;
+		}
+		M->H = H;
+		M->Hs = (size_t)jobs * k;
+	}
+	for (j = 0; j < jobs; j++) {
+		M->J[j].off = from + j*part;
+		M->J[j].len = j == jobs-1 ? L->n - M->J[j].off : part;
+	}
+	M->out = L;
+	M->k = k;
+	pool_run(&M->P, rank_job, M, jobs);
+	n = from ? L->ranked : 0;
+	for (j = 0; j < jobs; j++) {
+		n += M->J[j].n;
+	}
+	if (!(K = malloc(n * sizeof(rank) + 1))) {
+		return -1;
+	}
+	for (m = 0; from && m < L->ranked; m++) {
+		K[m].i = L->R[m];
+	}
+	for (j = 0; j < jobs; j++) {
+		for (n = 0; n < M->J[j].n; n++) {
+			K[m++].i = M->H[(size_t)j*k + n];
+		}
+	}
+	for (n = 0; n < m; n++) {
+		K[n].score = L->S[K[n].i];
+	}
+	qsort(K, m, sizeof(rank), rank_cmp);
+	m = m < k ? m : k;
+	if (!(R = realloc(L->R, m * sizeof(int) + 1))) {
+		free(K);
+		return -1;
+	}
+	for (n = 0; n < m; n++) {
+		R[n] = K[n].i;
+	}
+	free(K);
+	L->R = R;
+	L->ranked = m;
+	L->rn = L->n;
+	return 0;
+}
+
+void cache_init(cache *K, size_t max)
+{
+	memset(K, 0, sizeof(*K));
+	K->max = max;
+}
+
+static size_t mlist_size(mlist *L)
+{
+	return (L->n+1) * (sizeof(uint32_t) + (L->S ? sizeof(int) : 0))
+		+ L->ranked * sizeof(int);
+}
+
+static void cache_drop(cache *K, int i)
+{
+	K->size -= mlist_size(&K->R[i].L);
+	free(K->R[i].query);
+	mlist_free(&K->R[i].L);
+	memmove(K->R+i, K->R+i+1, (K->n-i-1) * sizeof(result));
+	K->n--;
+}
+
+/* Takes ownership of query q and of L, its matches */
+void cache_push(cache *K, char *q, int cflags, mlist *L, int num)
+{
+	result *R;
+	void *p;
+
+	if (K->n == K->cap) {
+		R = realloc(K->R, (K->cap ? 2*K->cap : 16) * sizeof(result));
+		if (!R) {
+			free(q);
+			mlist_free(L);
+			return;
+		}
+		K->R = R;
+		K->cap = K->cap ? 2*K->cap : 16;
+	}
+	R = &K->R[K->n];
+	R->query = q;
+	R->cflags = cflags;
+	R->num = num;
+	R->L = *L;
+	mlist_init(L);
+	/* Lists were sized for the whole corpus */
+	if ((p = realloc(R->L.E, (R->L.n+1) * sizeof(uint32_t)))) {
+		R->L.E = p;
+	}
+	if (R->L.S && (p = realloc(R->L.S, (R->L.n+1) * sizeof(int)))) {
+		R->L.S = p;
+	}
+	R->L.cap = R->L.n+1;
+	K->size += mlist_size(&R->L);
+	K->n++;
+	while (K->n && K->size > K->max) {
+		cache_drop(K, 0);
+	}
+}
+
+/*
+ * Moves saved result of query q from cache to L.
+ * num is set to size of corpus it covers. Returns 1 if found.
+ */
+int cache_take(cache *K, char *q, int cflags, mlist *L, int *num)
+{
+	int i;
+
+	for (i = K->n-1; i >= 0; i--) {
+		if (K->R[i].cflags == cflags && !strcmp(K->R[i].query, q)) {
+			*num = K->R[i].num;
+			K->size -= mlist_size(&K->R[i].L);
+			*L = K->R[i].L;
+			mlist_init(&K->R[i].L);
+			K->size += mlist_size(&K->R[i].L);
+			cache_drop(K, i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void cache_free(cache *K)
+{
+	while (K->n) {
+		cache_drop(K, K->n-1);
+	}
+	free(K->R);
+	memset(K, 0, sizeof(*K));
+}
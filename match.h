@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <regex.h>
+
+#include "corpus.h"
+#include "dfa.h"
+#include "index.h"
+#include "pool.h"
+#include "search.h"
+
+/* Not regcomp() flags. Query is matched as a fuzzy subsequence. */
+#define M_FUZZY (1 << 24)
+/* Query is made of terms, see parse_terms() */
+#define M_EXTENDED (1 << 25)
+#define M_FLAGS (M_FUZZY | M_EXTENDED)
+
+/* Entries seen since compiled and how many were rejected by what */
+typedef struct mstats {
+	size_t tested;
+	size_t skipped; /* In blocks ruled out by their summary */
+	size_t indexed; /* Lacking a trigram of the query */
+	size_t masked; /* Lacking a character of the query */
+	size_t filtered; /* Lacking literals the nfa requires */
+} mstats;
+
+/* How a term is matched, cheapest first */
+enum term_kind {
+	T_EQUAL,
+	T_PREFIX,
+	T_SUFFIX,
+	T_EXACT,
+	T_FUZZY,
+	T_REGEX,
+};
+
+/* A query is terms that all have to match, or one of those ORed together */
+typedef struct term {
+	enum term_kind kind;
+	char *s; /* Fuzzy: lower case unless case sensitive */
+	size_t len;
+	_Bool neg; /* Matches what s doesn't */
+	_Bool folded; /* s is str_fold()ed and compared with copies of entries */
+	_Bool or; /* Next term is an alternative to this one */
+	needle N; /* of T_EXACT */
+	_Bool nfa; /* T_REGEX compiled to A, regcomp() is not used */
+	nfa A;
+	/* T_REGEX for positions of matches, compiled when first needed */
+	int rok; /* 1 if compiled, -1 if it failed */
+	regex_t R;
+} term;
+
+/* What a thread needs to match a regex term on its own */
+typedef struct tstate {
+	_Bool ok;
+	regex_t R;
+	dfa D;
+} tstate;
+
+/* What each thread needs to match on its own */
+typedef struct mstate {
+	tstate *T; /* One for each term */
+	char *line; /* Copy of an entry that is not terminated */
+	size_t lines;
+	mstats st;
+} mstate;
+
+/* A job covers entries [off, off+len) of its input */
+typedef struct mjob {
+	int off, len, n;
+} mjob;
+
+/* Bytes of an entry that a query matched */
+typedef struct mspan {
+	uint32_t off, len;
+} mspan;
+
+/* Spans of this many entries being shown are kept, see entry_spans() */
+#define SPAN_CACHE 256
+/* Spans kept of one entry */
+#define SPAN_MAX 32
+
+typedef struct spans {
+	uint32_t id; /* 1 + entry, 0 if none */
+	int n;
+	mspan S[SPAN_MAX];
+} spans;
+
+/*
+ * Set of matching entries, see set.h, and scores of fuzzy matches in S.
+ * R has positions in E of the best of the first rn, best first.
+ */
+typedef struct mlist {
+	uint32_t *E;
+	int *S;
+	int *R;
+	int ranked, rn;
+	int n, cap;
+} mlist;
+
+typedef struct matcher {
+	char *query;
+	int cflags;
+	term *T; /* In the order they are tested */
+	int terms;
+	/* What every match has: str_mask(), length and str_bigrams() */
+	uint64_t mask;
+	size_t minL;
+	uint64_t bigram[64];
+	_Bool bigrams;
+	_Bool ok; /* query compiled */
+	int fold; /* How entries are str_fold()ed, if they have copies */
+	tindex *I; /* Of the corpus, once built */
+	uint32_t *cand; /* Indexed entries that may match, if ncand >= 0 */
+	int ncand;
+	_Bool cands; /* cand was looked up for this query */
+	pool P;
+	mstate *S; /* One for each thread of P */
+	mjob *J;
+	int jobs;
+	/* Input and output of the jobs being run */
+	corpus *C;
+	mlist *in, *out;
+	int from, to;
+	int *H, k; /* Heaps of the k best, one for each ranking job */
+	size_t Hs;
+	spans *sp; /* SPAN_CACHE slots, by entry */
+} matcher;
+
+/* A saved match list of a query */
+typedef struct result {
+	char *query;
+	int cflags;
+	int num; /* Size of corpus when the list was complete */
+	mlist L;
+} result;
+
+/*
+ * Results of recent queries, so that going back to one is instant.
+ * The oldest are dropped when they take more than max bytes.
+ */
+typedef struct cache {
+	result *R;
+	int n, cap;
+	size_t size, max;
+} cache;
+
+int matcher_init(matcher*, int);
+int matcher_compile(matcher*, char*, int);
+_Bool query_refines(char*, int, char*, int);
+void matcher_index(matcher*, tindex*);
+void matcher_fold(matcher*, int);
+void matcher_stats(matcher*, mstats*);
+void matcher_free(matcher*);
+
+void mlist_init(mlist*);
+int mlist_reserve(mlist*, int, _Bool);
+int entry_spans(matcher*, corpus*, uint32_t, const mspan**);
+int mlist_id(mlist*, int);
+entry *mlist_at(mlist*, corpus*, int);
+void mlist_free(mlist*);
+
+int entry_match(matcher*, corpus*, int, int, mlist*);
+int entry_refine(matcher*, corpus*, mlist*, int, int, mlist*);
+int entry_rank(matcher*, mlist*, int);
+
+void cache_init(cache*, size_t);
+void cache_push(cache*, char*, int, mlist*, int);
+int cache_take(cache*, char*, int, mlist*, int*);
+void cache_free(cache*);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct worker {
+	pool *P;
+	int id;
+} worker;
+
+/* Runs jobs until there are none left. Called with P->mx locked. */
+static void run_jobs(pool *P, int id)
+{
+	pool_fn fn;
+	void *arg;
+	int j;
+
+	while (P->next < P->jobs) {
+		j = P->next++;
+		fn = P->fn;
+		arg = P->arg;
+		pthread_mutex_unlock(&P->mx);
+		fn(arg, j, id);
+		pthread_mutex_lock(&P->mx);
+		if (++P->finished == P->jobs) {
+			pthread_cond_signal(&P->done);
+		}
+	}
+}
+
+static void *work(void *arg)
+{
+	worker *W = arg;
+	pool *P = W->P;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&P->mx);
+	for (;;) {
+		while (!P->quit && P->gen == seen) {
+			pthread_cond_wait(&P->go, &P->mx);
+		}
+		if (P->quit) break;
+		seen = P->gen;
+		run_jobs(P, W->id);
+	}
+	pthread_mutex_unlock(&P->mx);
+	free(W);
+	return 0;
+}
+
+/* Returns 0 on success */
+int pool_init(pool *P, int threads)
+{
+	worker *W;
+	int i;
+
+	memset(P, 0, sizeof(*P));
+	P->threads = 1;
+	if (pthread_mutex_init(&P->mx, 0)
+	|| pthread_cond_init(&P->go, 0)
+	|| pthread_cond_init(&P->done, 0)) {
+		return -1;
+	}
+	if (threads > 1 && !(P->T = calloc(threads, sizeof(pthread_t)))) {
+		return -1;
+	}
+	for (i = 1; i < threads; i++) {
+		if (!(W = malloc(sizeof(worker)))) {
+			return -1;
+		}
+		W->P = P;
+		W->id = i;
+		if (pthread_create(&P->T[i], 0, work, W)) {
+			free(W);
+			return -1;
+		}
+		P->threads++;
+	}
+	return 0;
+}
+
+/* Runs fn(arg, job, thread) for every job in [0, jobs) and waits for them */
+void pool_run(pool *P, pool_fn fn, void *arg, int jobs)
+{
+	pthread_mutex_lock(&P->mx);
+	P->fn = fn;
+	P->arg = arg;
+	P->jobs = jobs;
+	P->next = P->finished = 0;
+	P->gen++;
+	if (P->threads > 1 && jobs > 1) {
+		pthread_cond_broadcast(&P->go);
+	}
+	run_jobs(P, 0);
+	while (P->finished < P->jobs) {
+		pthread_cond_wait(&P->done, &P->mx);
+	}
+	pthread_mutex_unlock(&P->mx);
+}
+
+void pool_free(pool *P)
+{
+	int i;
+
+	pthread_mutex_lock(&P->mx);
+	P->quit = 1;
+	pthread_cond_broadcast(&P->go);
+	pthread_mutex_unlock(&P->mx);
+	for (i = 1; i < P->threads; i++) {
+		pthread_join(P->T[i], 0);
+	}
+	free(P->T);
+	pthread_mutex_destroy(&P->mx);
+	pthread_cond_destroy(&P->go);
+	pthread_cond_destroy(&P->done);
+	memset(P, 0, sizeof(*P));
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+/* Called for each job with index of the job and of the thread running it */
+typedef void (*pool_fn)(void*, int, int);
+
+/*
+ * Persistent worker threads. The thread calling pool_run() works too,
+ * as thread 0, so a pool of 1 thread doesn't start any.
+ */
+typedef struct pool {
+	int threads;
+	pthread_t *T;
+	pthread_mutex_t mx;
+	pthread_cond_t go, done;
+	pool_fn fn;
+	void *arg;
+	int jobs, next, finished;
+	unsigned gen;
+	_Bool quit;
+} pool;
+
+int pool_init(pool*, int);
+void pool_run(pool*, pool_fn, void*, int);
+void pool_free(pool*);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Substring search. Candidates are positions where both the first and the
+ * last byte of the needle match, found 16 at a time with SSE2.
+ * Only those are compared in full.
+ */
+
+#include "search.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+static _Bool is_alpha(unsigned char c)
+{
+	return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+static unsigned char lower(unsigned char c)
+{
+	return 'A' <= c && c <= 'Z' ? c | 0x20 : c;
+}
+
+/* Returns 0 on success */
+int needle_init(needle *N, const char *s, size_t n, _Bool icase)
+{
+	size_t i;
+
+	memset(N, 0, sizeof(*N));
+	if (!(N->s = malloc(n+1))) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		N->s[i] = icase ? lower(s[i]) : s[i];
+	}
+	N->s[n] = 0;
+	N->n = n;
+	N->icase = icase;
+	if (icase && n) {
+		N->fold_first = is_alpha(N->s[0]) ? 0x20 : 0;
+		N->fold_last = is_alpha(N->s[n-1]) ? 0x20 : 0;
+	}
+	return 0;
+}
+
+void needle_free(needle *N)
+{
+	free(N->s);
+	memset(N, 0, sizeof(*N));
+}
+
+static _Bool equal(needle *N, const char *h)
+{
+	size_t i;
+
+	if (!N->icase) {
+		return !memcmp(N->s, h, N->n);
+	}
+	for (i = 0; i < N->n; i++) {
+		if (lower(h[i]) != (unsigned char)N->s[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Returns first occurence of the needle in h (n bytes) or 0 */
+char *needle_find(needle *N, char *h, size_t n)
+{
+	char *e;
+	size_t i = 0;
+
+	if (N->n == 0) {
+		return h;
+	}
+	if (N->n > n) {
+		return 0;
+	}
+	e = h + n - N->n;
+#if defined(__SSE2__)
+	{
+	const __m128i F = _mm_set1_epi8(N->s[0]);
+	const __m128i L = _mm_set1_epi8(N->s[N->n-1]);
+	const __m128i FF = _mm_set1_epi8(N->fold_first);
+	const __m128i FL = _mm_set1_epi8(N->fold_last);
+	__m128i a, b;
+	unsigned m;
+
+	for (; h+i+16 <= e+1; i += 16) {
+		a = _mm_or_si128(FF, _mm_loadu_si128((__m128i*)(h+i)));
+		b = _mm_or_si128(FL, _mm_loadu_si128((__m128i*)(h+i+N->n-1)));
+		m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, F),
+		                                    _mm_cmpeq_epi8(b, L)));
+		while (m) {
+			if (equal(N, h+i+__builtin_ctz(m))) {
+				return h+i+__builtin_ctz(m);
+			}
+			m &= m-1;
+		}
+	}
+	}
+#endif
+	for (; h+i <= e; i++) {
+		if (((unsigned char)h[i] | N->fold_first) == (unsigned char)N->s[0]
+		&& equal(N, h+i)) {
+			return h+i;
+		}
+	}
+	return 0;
+}
@@ -37,45 +37,71 @@ SOFTWARE.
 #include <signal.h>
 #include <fcntl.h>
 #include <regex.h>
+#include <time.h>
+#include <limits.h>
 
 #include "terminal.h"
 #include "edit.h"
+#include "corpus.h"
+#include "match.h"
 
 #define NO_ARG do { ++*argv; if (!(mid = **argv)) argv++; } while (0)
 
+/* How many lines are read from a pipe before the screen is refreshed */
+#define READ_BATCH (16*1024)
+
+/* Limit of -j */
+#define MAX_THREADS 256
+
+/* Memory for match lists of previous queries */
+#define CACHE_MAX (128*1024*1024)
+
+/*
+ * Matching is done in slices between checks for input.
+ * Their size is adjusted so that one takes about this long.
+ */
+#define SLICE_MS 20
+
+/* Fewer lines than this are not worth indexing (-I) */
+#define INDEX_MIN 100000
+
+/* Pasted text that stops coming for this long (us) is taken as complete */
+#define PASTE_WAIT 100000
+
+/* Shown at the right of the prompt while matching, 9 columns wide */
+#define SCANNING "scanning\xe2\x80\xa6"
+#define SCANNING_W 9
+
+/* Memory is shown beside it in MiB, rounded up */
+#define MIB(n) (((n) + (1 << 20)-1) >> 20)
+
+/* Matched parts of entries are drawn in this color */
+#define SGR_MATCH "\x1b[31m"
+
 /* TODO
- * - VEEEERY SLOW
  * - exits on itself (?) when terminal changes size
  * - long input must scroll
- * - match fragment highlight
  */
 
-typedef struct entry {
-	struct entry *next;
-	_Bool selected;
-	unsigned short L;
-	char str[];
-} entry;
-
 static void err(const char*, ...);
+static long msec(void);
+static void retire(cache*, char**, int, mlist*, int);
 static int digits(int);
-static int utf8_limit_width(char*, int);
-static int xgetline(int, char*, size_t, char *[2]);
-static void entry_free(entry*);
-static void entry_print_matching_and_free(entry**, int);
-static int entry_match(entry*, entry**, char*, int);
-static int read_entries(int, entry**, entry**);
+static int utf8_limit_width(char*, size_t, int);
+static void draw_str(int, char*, size_t, int, const mspan*, int, size_t, const char*);
+static void entry_print_selected(mlist*, corpus*, int, char);
 static int str2num(char*, int, int);
 static char* EARG(char***);
 static char* ARG(char***);
+static char* LARG(char***, const char*);
+static void str2fields(char*, int[2]);
 static char* basename(char*);
 static void usage(char*);
 static void setup_signals(void);
 static void sighandler(int);
 static void prepare_window(int, int*, int*);
-static void view_range_draw(int, entry**, int[2], int, int, int);
-static void view_range_move(entry**, int[2], int*, int);
-static void fill_matching(entry*, entry**);
+static void view_range_draw(int, matcher*, mlist*, corpus*, int[2], int, int, int);
+static void view_range_move(mlist*, int[2], int*, int);
 
 /*
  * Globals
@@ -89,6 +115,8 @@ static int list_height = -1;
 static int drawfd = 2;
 static int inputfd = 0;
 static struct termios old;
+/* Flags of stdin before it was made non-blocking, or -1 */
+static int inflags = -1;
 
 static void err(const char *fmt, ...)
 {
@@ -97,9 +125,32 @@ static void err(const char *fmt, ...)
 	va_start(a, fmt);
 	vdprintf(2, fmt, a);
 	va_end(a);
+	if (inflags != -1) {
+		fcntl(0, F_SETFL, inflags);
+	}
 	exit(EXIT_FAILURE);
 }
 
+static long msec(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/* Moves list L of query *q, if any, to cache */
+static void retire(cache *K, char **q, int cflags, mlist *L, int num)
+{
+	if (*q) {
+		cache_push(K, *q, cflags, L, num);
+		*q = 0;
+	}
+	else {
+		mlist_free(L);
+	}
+}
+
 static int digits(int n)
 {
 	int d = 0;
@@ -111,12 +162,13 @@ static int digits(int n)
 	return d ? d : 1;
 }
 
-/* Returns the number of bytes that have maximum width W */
-static int utf8_limit_width(char *S, int W)
+/* Returns the number of bytes (out of L) that have maximum width W */
+static int utf8_limit_width(char *S, size_t L, int W)
 {
-	int bytes = 0, b, cp, cpw;
+	int b, cp, cpw;
+	size_t bytes = 0;
 
-	while ((b = utf8_dechar(&cp, S)) && W) {
+	while (bytes < L && (b = utf8_dechar(&cp, S)) && W) {
 		cpw = utf8_cp2w(cp);
 		if (W < cpw) break;
 		W -= cpw;
@@ -126,118 +178,74 @@ static int utf8_limit_width(char *S, int W)
 	return bytes;
 }
 
-/* TODO test other line endings like \r\n */
-static int xgetline(int fd, char *buf, size_t bufs, char *b[2])
+/*
+ * Draws as much of S as fits in W columns. Tabs are expanded and other
+ * control characters are shown as ^X, so that a record containing
+ * newlines still takes exactly one row.
+ * Bytes in h spans H, whose offsets are off less, are drawn in SGR_MATCH
+ * and after them the color is set back by fg.
+ */
+static void draw_str(int fd, char *S, size_t L, int W,
+	const mspan *H, int h, size_t off, const char *fg)
 {
-	char *src, *dst;
-	size_t s;
-	ssize_t r;
-	int i, L = 0;
-
-	src = b[0];
-	dst = buf;
-	i = s = b[1] - b[0];
-	while (i--) {
-		*dst++ = *src++;
-	}
-	b[0] = buf;
-	b[1] = buf + s;
-
-	for (;;) {
-		while (*b[0] != '\n' && *b[0] != '\r' && b[1] - b[0] > 0) {
-			b[0]++;
+	char buf[1024], *B = S, *E = S+L;
+	int n = 0, b, cp, cpw, col = 0;
+	_Bool on = 0, in;
+	size_t o;
+
+	while (S < E && (b = utf8_dechar(&cp, S)) && S+b <= E) {
+		if (cp == '\t') {
+			cpw = 8 - col%8;
 		}
-		if (b[1] - b[0] > 0 && (*b[0] == '\n' || *b[0] == '\r')) {
-			L = b[0] - buf;
-			break;
+		else if (cp < 0x20 || cp == 0x7f) {
+			cpw = 2;
 		}
 		else {
-			r = read(fd, b[1], bufs-(b[1]-buf));
-			if (r == -1) {
-				return -2;
-			}
-			if (r == 0) {
-				return -1;
-			}
-			b[1] += r;
+			cpw = utf8_cp2w(cp);
 		}
-	}
-	*b[0] = 0;
-	b[0]++;
-	if (b[1] - b[0] > 0 && (*b[0] == '\n' || *b[0] == '\r')) {
-		*b[0] = 0;
-		b[0]++;
-	}
-	return L;
-}
-
-static void entry_free(entry *H)
-{
-	entry *F;
-	while (H) {
-		F = H;
-		H = H->next;
-		free(F);
-	}
-}
-
-static void entry_print_matching_and_free(entry **M, int fd)
-{
-	while (*M) {
-		if ((*M)->selected) {
-			dprintf(fd, "%s\n", (*M)->str);
+		if (col+cpw > W) break;
+		/* Room for a character, color changes and the final reset */
+		if (n + 16 + (int)sizeof(SGR_MATCH) > (int)sizeof(buf)) {
+			write(fd, buf, n);
+			n = 0;
 		}
-		free(*M);
-		++M;
-	}
-}
-
-static int entry_match(entry *H, entry **L, char *reg, int cflags)
-{
-	regex_t R;
-	int n = 0, e, eflags = 0;
-	regmatch_t pmatch;
-
-	e = regcomp(&R, reg, cflags);
-	if (e) return 0;
-
-	*L = 0;
-	L++;
-	while (H) {
-		if (0 == regexec(&R, H->str, 1, &pmatch, eflags)) {
-			*L = H;
-			L++;
-			*L = 0;
-			n++;
+		for (o = off + (S - B); h && H->off + H->len <= o; H++, h--);
+		if ((in = h && H->off <= o) != on) {
+			n += sprintf(buf+n, "%s", in ? SGR_MATCH : fg);
+			on = in;
+		}
+		if (cp == '\t') {
+			memset(buf+n, ' ', cpw);
+			n += cpw;
 		}
-		H = H->next;
+		else if (cp < 0x20 || cp == 0x7f) {
+			buf[n++] = '^';
+			buf[n++] = cp ^ 0x40;
+		}
+		else {
+			memcpy(buf+n, S, b);
+			n += b;
+		}
+		col += cpw;
+		S += b;
 	}
-	regfree(&R);
-	return n;
+	if (on) {
+		n += sprintf(buf+n, "%s", fg);
+	}
+	write(fd, buf, n);
 }
 
-static int read_entries(int fd, entry **head, entry **last)
+static void entry_print_selected(mlist *M, corpus *C, int fd, char delim)
 {
-	entry *q;
-	int n = 0, L;
-	char buf[BUFSIZ];
-	char *b[2] = { buf, buf };
-
-	*head = 0;
-	while (0 <= (L = xgetline(fd, buf, sizeof(buf), b))) {
-		q = calloc(1, sizeof(entry)+L+1);
-		q->L = L;
-		memcpy(q->str, buf, L+1);
-		if (!*head) {
-			*head = q;
-		}
-		else {
-			(*last)->next = q;
+	entry *e;
+	int i;
+
+	for (i = 1; (e = mlist_at(M, C, i)); i++) {
+		if (e->selected) {
+			write(fd, e->str, e->L);
+			write(fd, &delim, 1);
 		}
-		*last = q;
-		n++;
 	}
-	return L == -2 ? -1 : n;
 }
 
 static int str2num(char *s, int min, int max)
@@ -290,6 +298,59 @@ static char* EARG(char ***argv)
 	return a;
 }
 
+/*
+ * Returns value of long option name (without the first dash),
+ * given as --name=V or --name V, or 0 if it's another option
+ */
+static char* LARG(char ***argv, const char *name)
+{
+	size_t n = strlen(name);
+
+	if (strncmp(**argv, name, n)) {
+		return 0;
+	}
+	if ((**argv)[n] == '=') {
+		return **argv + n + 1;
+	}
+	if ((**argv)[n]) {
+		return 0;
+	}
+	if (!(*argv)[1]) {
+		err("ERROR: Expected argument.\n");
+	}
+	return *++*argv;
+}
+
+/* Parses range of fields N, N..M, N.. or ..M. Negative N counts from last. */
+static void str2fields(char *s, int r[2])
+{
+	char *e;
+
+	r[0] = 1;
+	r[1] = -1;
+	if (strncmp(s, "..", 2)) {
+		r[0] = r[1] = strtol(s, &e, 10);
+		if (e == s || r[0] == 0) {
+			err("ERROR: Bad field range.\n");
+		}
+		s = e;
+		if (!*s) {
+			return;
+		}
+		r[1] = -1;
+	}
+	if (strncmp(s, "..", 2)) {
+		err("ERROR: Bad field range.\n");
+	}
+	s += 2;
+	if (*s) {
+		r[1] = strtol(s, &e, 10);
+		if (*e || r[1] == 0) {
+			err("ERROR: Bad field range.\n");
+		}
+	}
+}
+
 static char* basename(char *S)
 {
 	char *s = S;
@@ -306,7 +367,27 @@ static void usage(char *argv0)
 	"Options:\n"
 	"    -L N   Set maximal number of lines.\n"
 	"    -E     Use extended regex.\n"
+	"    -f     Fuzzy matching. Best matches go first.\n"
+	"    -x     Extended search. Space separated terms must all match:\n"
+	"           'exact ^prefix suffix$ !not, and this | or-that.\n"
 	"    -i     Case sensitive.\n"
+	"    -C     Keep a lower case copy of input, taking as much memory again,\n"
+	"           to search it case insensitively faster, in any script.\n"
+	"    -N     Like -C, also ignoring diacritics: zolc finds Żółć.\n"
+	"    -j N   Match using N threads. Default is number of CPUs.\n"
+	"    -I N   Index trigrams of a long input once read, in the background,\n"
+	"           if it takes at most N MiB. Speeds up searching for literals.\n"
+	"    -0, --read0\n"
+	"           Read input delimited by NUL instead of newline.\n"
+	"    --print0\n"
+	"           Print output delimited by NUL instead of newline.\n"
+	"    --nth=N[..M]\n"
+	"           Match only fields N to M of each line. Negative N counts\n"
+	"           from the last field. Lines are printed whole.\n"
+	"    --with-nth=N[..M]\n"
+	"           Show only fields N to M of each line.\n"
+	"    --delimiter=C\n"
+	"           Split lines into fields by character C instead of TAB.\n"
 	"    -h     Display this help message and exit.\n");
 }
 
@@ -342,7 +423,11 @@ static void sighandler(int sig)
 
 		set_cur_pos(drawfd, x, y);
 		unraw(&old, inputfd);
+		write(drawfd, SL(CSI_PASTE_OFF));
 		write(drawfd, SL(CSI_CURSOR_SHOW));
+		if (inflags != -1) {
+			fcntl(0, F_SETFL, inflags);
+		}
 		exit(EXIT_SUCCESS);
 	default:
 		break;
@@ -365,29 +450,47 @@ static void prepare_window(int fd, int *x, int *y)
 	}
 }
 
-static void view_range_draw(int fd, entry **L, int view[2], int hl, int W, int H)
+static void view_range_draw(int fd, matcher *X, mlist *M, corpus *C, int view[2], int hl, int W, int H)
 {
-	int c, b, ind;
+	int c, ind, k, h;
+	const mspan *S;
+	uint32_t *sp;
+	size_t off;
+	entry *e;
+	char *s;
+	size_t L;
 
 	c = view[0];
-	while (L[c] && H) {
-		b = utf8_limit_width(L[c]->str, W-2);
-		ind = c == hl || L[c]->selected ? '>' : ' ';
+	while ((k = mlist_id(M, c)) >= 0 && H) {
+		e = CORPUS_AT(C, k);
+		s = e->str;
+		L = e->L;
+		off = 0;
+		if (C->split) {
+			sp = CORPUS_FIELDS(C, k) + 2;
+			off = sp[0];
+			s += off;
+			L = sp[1];
+		}
+		/* Only rows being drawn have their matches found */
+		h = entry_spans(X, C, k, &S);
+		ind = c == hl || e->selected ? '>' : ' ';
 		if (c == hl) {
 			dprintf(fd,
 				"\x1b[%c%cm" /* CSI */
 				"\x1b[%c%cm" /* CSI */
 				CSI_CLEAR_LINE
-				"%c %.*s" /* entry */
-				"\x1b[%cm" /* CSI */
-				"\r\n", /* newline */
+				"%c ", /* indicator */
 				'3', '0',
 				'4', '7',
-				ind, b, L[c]->str,
-				'0');
+				ind);
+			draw_str(fd, s, L, W-2, S, h, off, "\x1b[30m");
+			dprintf(fd, "\x1b[%cm" "\r\n", '0');
 		}
 		else {
-			dprintf(fd, CSI_CLEAR_LINE "%c %.*s\r\n", ind, b, L[c]->str);
+			dprintf(fd, CSI_CLEAR_LINE "%c ", ind);
+			draw_str(fd, s, L, W-2, S, h, off, "\x1b[39m");
+			write(fd, "\r\n", 2);
 		}
 		c++;
 		H--;
@@ -398,56 +501,66 @@ static void view_range_draw(int fd, entry **L, int view[2], int hl, int W, int H
 	}
 }
 
-static void view_range_move(entry **L, int view[2], int *hl, int y)
+static void view_range_move(mlist *M, int view[2], int *hl, int y)
 {
 	if (y > 0) {
 		while (y--) {
-			if (L[1+*hl] && view[1] == 1+*hl) {
+			if (1+*hl <= M->n && view[1] == 1+*hl) {
 				++view[0];
 				++view[1];
 			}
-			if (L[1+*hl]) {
+			if (1+*hl <= M->n) {
 				++*hl;
 			}
 		}
 	}
 	else if (y < 0) {
 		while (y++) {
-			if (L[-1+*hl] && view[0] == *hl) {
+			if (-1+*hl >= 1 && view[0] == *hl) {
 				--view[0];
 				--view[1];
 			}
-			if (L[-1+*hl]) {
+			if (-1+*hl >= 1) {
 				--*hl;
 			}
 		}
 	}
 }
 
-static void fill_matching(entry *H, entry **L)
-{
-	L++;
-	while (H) {
-		*L = H;
-		L++;
-		*L = 0;
-		H = H->next;
-	}
-}
-
 int main(int argc, char *argv[])
 {
-	char s[4*1024], *argv0;
-	int d, i;
-	int selected = 0, num = 0, num_matching;
+	char s[4*1024], *argv0, *oq = 0, st[64];
+	int d, i, n, k, w, sw, ocflags = 0;
+	int selected = 0, num = 0, num_matching = 0;
+	/*
+	 * Scan in progress: entries [pk, prev.n) of prev are left to refine,
+	 * then entries of the corpus from done on are left to match
+	 */
+	int done = 0, pk = 0, covered = 0, step = CORPUS_BLOCK, c, added;
+	long t;
 	int outfd = 1;
 	int cflags = REG_ICASE | REG_NEWLINE;
-	_Bool mid = 0, update = 1;
+	char delim = '\n', outdelim = '\n';
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t imax = 0;
+	int fold = 0;
+	int nth[2] = { 1, -1 }, show[2] = { 1, -1 };
+	char fdelim = '\t', *a;
+	_Bool split = 0;
+	_Bool mid = 0, update = 1, refine, refining = 0, scanning, ook = 0;
+	_Bool paste = 0, fill;
 	edit E;
 	int view[2];
 	int highlight; // TODO find after change
-	entry **matching; // TODO simplify
-	entry *list[2] = { 0, 0 };
+	entry *hl;
+	mlist ML, prev;
+	corpus list;
+	matcher M;
+	tindex X;
+	cache K;
+	reader rd;
+	fd_set fds;
+	struct timeval tv;
 	input I;
 
 	(void)argc;
@@ -470,9 +583,62 @@ int main(int argc, char *argv[])
 			cflags |= REG_EXTENDED;
 			NO_ARG;
 			break;
+		case 'f':
+			cflags |= M_FUZZY;
+			NO_ARG;
+			break;
+		case 'x':
+			cflags |= M_EXTENDED;
+			NO_ARG;
+			break;
+		case 'C':
+			fold = FOLD_CASE;
+			NO_ARG;
+			break;
+		case 'N':
+			fold = FOLD_CASE | FOLD_MARKS;
+			NO_ARG;
+			break;
+		case '0':
+			delim = 0;
+			NO_ARG;
+			break;
+		case '-':
+			if (!strcmp(*argv, "-read0")) {
+				delim = 0;
+			}
+			else if (!strcmp(*argv, "-print0")) {
+				outdelim = 0;
+			}
+			else if ((a = LARG(&argv, "-nth"))) {
+				str2fields(a, nth);
+				split = 1;
+			}
+			else if ((a = LARG(&argv, "-with-nth"))) {
+				str2fields(a, show);
+				split = 1;
+			}
+			else if ((a = LARG(&argv, "-delimiter"))) {
+				if (!a[0] || a[1]) {
+					err("ERROR: Delimiter must be one character.\n");
+				}
+				fdelim = a[0];
+			}
+			else {
+				usage(argv0);
+				return 1;
+			}
+			argv++;
+			break;
+		case 'j':
+			threads = str2num(EARG(&argv), 1, MAX_THREADS);
+			break;
 		case 'L':
 			list_height = str2num(EARG(&argv), 1, 1000); // TODO
 			break;
+		case 'I':
+			imax = (size_t)str2num(EARG(&argv), 1, INT_MAX) << 20;
+			break;
 		case 'h':
 			usage(argv0);
 			NO_ARG;
@@ -499,135 +665,322 @@ int main(int argc, char *argv[])
 		if (inputfd == -1) {
 			err("Failed to open /dev/tty.\n");
 		}
-		num = read_entries(0, &list[0], &list[1]);
-
-		matching = malloc((num+2) * sizeof(entry*));
-		view[0] = 1;
-		view[1] = 1+(num < list_height ? num : list_height);
-		highlight = 1;
-		fill_matching(list[0], matching);
-
-		if (num == 0) {
+		corpus_init(&list);
+		list.fold = fold;
+		list.split = split;
+		list.fdelim = fdelim;
+		memcpy(list.nth, nth, sizeof(nth));
+		memcpy(list.show, show, sizeof(show));
+		reader_init(&rd, 0, delim);
+		rd.eof = 1;
+		if (-1 == (num = corpus_map(&list, 0, delim))) {
+			/* A pipe. Lines are read as they come in the main loop. */
+			num = 0;
+			rd.eof = 0;
+			/* Shared with whoever reads the pipe next, so restored at exit */
+			inflags = fcntl(0, F_GETFL);
+			fcntl(0, F_SETFL, inflags | O_NONBLOCK);
+		}
+		if (num == -2) {
+			err("ERROR: Out of memory.\n");
+		}
+		if (rd.eof && num == 0) {
 			usage(argv0);
 			return 0;
 		}
 	}
 
+	if (matcher_init(&M, threads < MAX_THREADS ? threads : MAX_THREADS)) {
+		err("ERROR: Out of memory.\n");
+	}
+	matcher_fold(&M, list.fold);
+	cache_init(&K, CACHE_MAX);
+	mlist_init(&ML);
+	index_init(&X);
+
 	if (-1 == raw(&old, inputfd)) {
 		err("Couldn't initialize terminal.\n");
 	}
 	write(drawfd, SL(CSI_CURSOR_HIDE));
+	write(drawfd, SL(CSI_PASTE_ON));
 	get_cur_pos(drawfd, &x, &y);
 	get_win_dims(drawfd, &winw, &winh);
 	prepare_window(drawfd, &x, &y);
 	edit_init(&E, s, sizeof(s));
 
 	for (;;) {
+		/* Input that is complete is indexed once, if asked to and long */
+		if (imax && rd.eof && list.num >= INDEX_MIN) {
+			index_start(&X, &list, imax);
+			imax = 0;
+		}
+		if (!M.I && index_ready(&X)) {
+			matcher_index(&M, &X);
+		}
 		if (update) {
 			update = 0;
-			num_matching = entry_match(list[0], matching, E.begin, cflags);
+			if (refining) {
+				/* Cancelled. prev is still complete up to covered. */
+				mlist_free(&ML);
+			}
+			else {
+				/* Complete up to done, even if the scan was cancelled */
+				prev = ML;
+				oq = M.query;
+				M.query = 0;
+				ocflags = M.cflags;
+				ook = M.ok;
+				covered = done;
+			}
+			mlist_init(&ML);
+			refine = oq && ook && query_refines(oq, ocflags, E.begin, cflags);
+			matcher_compile(&M, E.begin, cflags);
+			refining = 0;
+			done = 0;
+			if (cache_take(&K, E.begin, cflags, &ML, &done)) {
+				/* Lines read since it was saved are left to match */
+			}
+			else if (refine) {
+				/* Only what matched before can match now */
+				refining = 1;
+				pk = 0;
+				done = covered;
+			}
+			if (!refining) {
+				retire(&K, &oq, ocflags, &prev, covered);
+			}
+			if (mlist_reserve(&ML, 0, 0)) {
+				err("ERROR: Out of memory.\n");
+			}
+			num_matching = ML.n;
 			view[0] = 1;
 			view[1] = 1+(num_matching < list_height ? num_matching : list_height);
 			highlight = 1;
 		}
+		if (refining || done < list.num) {
+			t = msec();
+			/*
+			 * Until there is enough to fill the window, chunks start at
+			 * a block for each thread and grow, so that it's drawn as soon
+			 * as possible. The rest is matched in the following slices.
+			 */
+			fill = ML.n < list_height;
+			c = fill ? CORPUS_BLOCK * M.P.threads : step;
+			added = 0;
+			do {
+				if (refining) {
+					k = prev.n - pk < c ? prev.n : pk + c;
+					n = entry_refine(&M, &list, &prev, pk, k, &ML);
+					if ((pk = k) == prev.n) {
+						refining = 0;
+						retire(&K, &oq, ocflags, &prev, covered);
+					}
+				}
+				else {
+					k = list.num - done < c ? list.num : done + c;
+					n = entry_match(&M, &list, done, k, &ML);
+					done = k;
+				}
+				if (n == -1) {
+					err("ERROR: Out of memory.\n");
+				}
+				added += n;
+				c = c < INT_MAX/2 ? 2*c : c;
+			} while (fill && ML.n < list_height && (refining || done < list.num)
+			&& msec() - t < SLICE_MS);
+			num_matching = ML.n;
+			if (view[1]-view[0] < list_height) {
+				n = num_matching-view[0]+1;
+				view[1] = view[0]+(n < list_height ? n : list_height);
+			}
+			/* Chunks that filled the window say little about the speed */
+			t = msec() - t;
+			if (!fill && t < SLICE_MS/2 && step < INT_MAX/2) {
+				step *= 2;
+			}
+			else if (!fill && t > 2*SLICE_MS && step > CORPUS_BLOCK) {
+				step /= 2;
+			}
+		}
+		scanning = refining || done < list.num;
+		/* Best matches are ranked as far as they are shown, and a page ahead */
+		if (entry_rank(&M, &ML, view[1]-1 + list_height)) {
+			err("ERROR: Out of memory.\n");
+		}
 
 		set_cur_pos(drawfd, x, y);
-		view_range_draw(drawfd, matching, view, highlight, winw, list_height);
+		view_range_draw(drawfd, &M, &ML, &list, view, highlight, winw, list_height);
 		write(drawfd, SL(CSI_CLEAR_LINE));
 
+		/* Right of the prompt: memory of folded copies and index, and progress */
+		n = 0;
+		if (list.fold) {
+			n += snprintf(st+n, sizeof(st)-n, " copy %zuM", MIB(list.folded));
+		}
+		if (M.I) {
+			n += snprintf(st+n, sizeof(st)-n, " index %zuM", MIB(X.size));
+		}
+		sw = n;
+		if (scanning) {
+			n += snprintf(st+n, sizeof(st)-n, " %s", SCANNING);
+			sw += 1+SCANNING_W;
+		}
+
 		d = digits(num);
 		i = d+1+d+1+d+3;
+		w = winw-i-sw;
 		dprintf(drawfd, "%*d/%*d/%d > %.*s",
 			d, selected, d, num_matching, num,
-			utf8_limit_width(E.begin, winw-i), E.begin);
+			utf8_limit_width(E.begin, E.end-E.begin, w > 0 ? w : 0), E.begin);
+		if (sw && w > 0) {
+			set_cur_pos(drawfd, winw-sw+2, y+list_height);
+			write(drawfd, st+1, n-1);
+		}
 
 		set_cur_pos(drawfd, E.cur_x+i+1, y+list_height);
 
 		write(drawfd, SL(CSI_CURSOR_SHOW));
-		I = get_input(inputfd);
+		FD_ZERO(&fds);
+		FD_SET(inputfd, &fds);
+		if (!rd.eof) {
+			FD_SET(0, &fds);
+		}
+		tv.tv_sec = tv.tv_usec = 0;
+		n = select(inputfd+1, &fds, 0, 0, rd.more || scanning ? &tv : 0);
 		write(drawfd, SL(CSI_CURSOR_HIDE));
-		set_cur_pos(drawfd, x, y);
+		if (n == -1) {
+			continue;
+		}
+		if (!rd.eof && (rd.more || FD_ISSET(0, &fds))) {
+			/*
+			 * On a read error rd.eof is set and what was read is kept.
+			 * New lines are matched in following slices.
+			 */
+			if (read_entries(&rd, &list, READ_BATCH) == -1 && !rd.eof) {
+				err("ERROR: Out of memory.\n");
+			}
+			num = list.num;
+			if (rd.eof && num == 0) {
+				goto end;
+			}
+		}
+		if (!FD_ISSET(inputfd, &fds)) {
+			continue;
+		}
+		/*
+		 * Everything typed so far is applied before matching again,
+		 * so that a burst of keys, or a paste, is matched once
+		 */
+		do {
+			I = get_input(inputfd);
+			set_cur_pos(drawfd, x, y);
+			if (paste) {
+				/* Control characters of pasted text are not keys */
+				if (I.t == IT_UTF8) {
+					edit_insert(&E, I.utf, utf8_b2len(I.utf));
+				}
+				paste = !(I.t == IT_SPEC && I.s == S_PASTE_END);
+				continue;
+			}
 
-		switch (I.t) {
-		case IT_NONE:
-		default:
-			break;
-		case IT_EOF:
-			goto end;
-		case IT_UTF8:
-			update = 1;
-			edit_insert(&E, I.utf, utf8_b2len(I.utf));
-			break;
-		case IT_SPEC:
-			switch (I.s) {
+			switch (I.t) {
+			case IT_NONE:
 			default:
 				break;
-			case S_ESCAPE:
-				selected = 0;
+			case IT_EOF:
 				goto end;
-			case S_BACKSPACE:
+			case IT_UTF8:
 				update = 1;
-				edit_delete(&E, -1);
+				edit_insert(&E, I.utf, utf8_b2len(I.utf));
 				break;
-			case S_DELETE:
-				update = 1;
-				edit_delete(&E, 1);
-				break;
-			case S_PAGE_UP:
-				view_range_move(matching, view, &highlight, -list_height);
-				break;
-			case S_PAGE_DOWN:
-				view_range_move(matching, view, &highlight, list_height);
-				break;
-			CASE_ONE_UP:
-			case S_ARROW_UP:
-				view_range_move(matching, view, &highlight, -1);
-				break;
-			CASE_ONE_DOWN:
-			case S_ARROW_DOWN:
-				view_range_move(matching, view, &highlight, 1);
-				break;
-			case S_ARROW_LEFT:
-				edit_move(&E, -1);
-				break;
-			case S_ARROW_RIGHT:
-				edit_move(&E, 1);
-				break;
-			case S_HOME:
-				edit_move(&E, -999); // TODO
-				break;
-			case S_END:
-				edit_move(&E, 999); // TODO
-				break;
-			}
-			break;
-		case IT_CTRL:
-			switch (I.utf[0]) {
-			case 'N':
-				goto CASE_ONE_DOWN;
-			case 'P':
-				goto CASE_ONE_UP;
-			case 'D':
-				selected = 0;
-				goto end;
-			case 'C':
-				raise(SIGINT);
+			case IT_SPEC:
+				switch (I.s) {
+				default:
+					break;
+				case S_ESCAPE:
+					selected = 0;
+					goto end;
+				case S_BACKSPACE:
+					update = 1;
+					edit_delete(&E, -1);
+					break;
+				case S_DELETE:
+					update = 1;
+					edit_delete(&E, 1);
+					break;
+				case S_PAGE_UP:
+					view_range_move(&ML, view, &highlight, -list_height);
+					break;
+				case S_PAGE_DOWN:
+					view_range_move(&ML, view, &highlight, list_height);
+					break;
+				CASE_ONE_UP:
+				case S_ARROW_UP:
+					view_range_move(&ML, view, &highlight, -1);
+					break;
+				CASE_ONE_DOWN:
+				case S_ARROW_DOWN:
+					view_range_move(&ML, view, &highlight, 1);
+					break;
+				case S_ARROW_LEFT:
+					edit_move(&E, -1);
+					break;
+				case S_ARROW_RIGHT:
+					edit_move(&E, 1);
+					break;
+				case S_HOME:
+					edit_move(&E, -999); // TODO
+					break;
+				case S_END:
+					edit_move(&E, 999); // TODO
+					break;
+				case S_PASTE_BEGIN:
+					update = paste = 1;
+					break;
+				}
 				break;
-			case 'M':
-			case 'J': /* ENTER */
-				if (!selected) {
-					matching[highlight]->selected = 1;
-					selected = 1;
+			case IT_CTRL:
+				switch (I.utf[0]) {
+				case 'N':
+					goto CASE_ONE_DOWN;
+				case 'P':
+					goto CASE_ONE_UP;
+				case 'D':
+					selected = 0;
+					goto end;
+				case 'C':
+					raise(SIGINT);
+					break;
+				case 'M':
+				case 'J': /* ENTER */
+					/* Moves in the same burst may pass what was ranked */
+					if (entry_rank(&M, &ML, highlight)) {
+						err("ERROR: Out of memory.\n");
+					}
+					if (!(hl = mlist_at(&ML, &list, highlight))) {
+						break;
+					}
+					if (!selected) {
+						hl->selected = 1;
+						selected = 1;
+					}
+					goto end;
+				case 'I': /* TAB */
+					if (entry_rank(&M, &ML, highlight)) {
+						err("ERROR: Out of memory.\n");
+					}
+					if (!(hl = mlist_at(&ML, &list, highlight))) {
+						break;
+					}
+					hl->selected = !hl->selected;
+					selected += hl->selected ? 1 : -1;
+					view_range_move(&ML, view, &highlight, 1);
+					break;
 				}
-				goto end;
-			case 'I': /* TAB */
-				matching[highlight]->selected = !matching[highlight]->selected;
-				selected += matching[highlight]->selected ? 1 : -1;
-				view_range_move(matching, view, &highlight, 1);
 				break;
 			}
-			break;
-		}
+		} while (input_pending(inputfd, paste ? PASTE_WAIT : 0));
+		paste = 0;
 	}
 end:
 	set_cur_pos(drawfd, x, y);
@@ -638,13 +991,27 @@ end:
 
 	set_cur_pos(drawfd, x, y);
 	unraw(&old, inputfd);
+	write(drawfd, SL(CSI_PASTE_OFF));
 	write(drawfd, SL(CSI_CURSOR_SHOW));
-
-	if (!selected) {
-		entry_free(list[0]);
-	}
-	else {
-		entry_print_matching_and_free(matching+1, outfd);
+	if (inflags != -1) {
+		fcntl(0, F_SETFL, inflags);
 	}
+
+	if (selected) {
+		if (entry_rank(&M, &ML, ML.n)) {
+			err("ERROR: Out of memory.\n");
+		}
+		entry_print_selected(&ML, &list, outfd, outdelim);
+	}
+	matcher_free(&M);
+	index_free(&X);
+	cache_free(&K);
+	free(oq);
+	if (refining) {
+		mlist_free(&prev);
+	}
+	mlist_free(&ML);
+	reader_free(&rd);
+	corpus_free(&list);
 	return 0;
 }
@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2019 Michał Czarnecki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "set.h"
+#include <stddef.h>
+
+/* Returns first of [p, end) not less than x, stepping ever further */
+uint32_t *set_gallop(const uint32_t *p, const uint32_t *end, uint32_t x)
+{
+	size_t lo = 0, hi = 1, n = end - p, m;
+
+	while (hi < n && p[hi] < x) {
+		lo = hi;
+		hi *= 2;
+	}
+	if (hi > n) {
+		hi = n;
+	}
+	while (lo < hi) {
+		m = lo + (hi-lo)/2;
+		if (p[m] < x) lo = m+1;
+		else hi = m;
+	}
+	return (uint32_t*)p + lo;
+}
+
+/*
+ * Leaves in A members of both A and B. Members of B are galloped over,
+ * so a small A costs little however big B is.
+ * Returns size of A.
+ */
+int set_and(uint32_t *A, int a, const uint32_t *B, int b)
+{
+	const uint32_t *p = B, *end = B+b;
+	int i, n = 0;
+
+	for (i = 0; i < a && p < end; i++) {
+		p = set_gallop(p, end, A[i]);
+		if (p < end && *p == A[i]) {
+			A[n++] = A[i];
+		}
+	}
+	return n;
+}
@@ -36,6 +36,8 @@ char *special_type_str[] = {
 	[S_BACKSPACE] = "bsp",
 	[S_DELETE] = "del",
 	[S_ESCAPE] = "esc",
+	[S_PASTE_BEGIN] = "paste",
+	[S_PASTE_END] = "pasted",
 };
 
 /* TODO more */
@@ -67,6 +69,8 @@ s2s seq2special[] = {
 	{ "\x1b[7~", S_HOME },
 	{ "\x1b[8~", S_END },
 	{ "\x1b[4h", S_INSERT },
+	{ "\x1b[200~", S_PASTE_BEGIN },
+	{ "\x1b[201~", S_PASTE_END },
 	{ "\x1b", S_ESCAPE },
 	{ NULL, S_NONE },
 };
@@ -230,6 +234,19 @@ exit:
 	return n;
 }
 
+/* Tells whether there is input on fd within 'to' microseconds */
+_Bool input_pending(int fd, suseconds_t to)
+{
+	fd_set s;
+	struct timeval t;
+
+	FD_ZERO(&s);
+	FD_SET(fd, &s);
+	t.tv_sec = 0;
+	t.tv_usec = to;
+	return select(fd+1, &s, 0, 0, &t) > 0;
+}
+
 static _Bool in(char c, char *S)
 {
 	while (*S && c != *S) S++;
@@ -274,7 +291,11 @@ input get_input(int fd)
 		retry:
 		if (tread1(seq+1, fd, t) && in(seq[1], "[O")) {
 			if (read1(seq+2, fd) && in(seq[2], "0123456789")) {
-				read1(seq+3, fd);
+				/* Parameters up to the final byte, as in ESC[200~ */
+				b = 3;
+				while (b < 7 && read1(seq+b, fd) && in(seq[b], "0123456789;")) {
+					b++;
+				}
 			}
 			else if (in(seq[2], "ABCDHFPVUY")) {
 			}
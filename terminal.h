@@ -45,6 +45,9 @@ SOFTWARE.
 #define CSI_SCREEN_ALTERNATIVE "\x1b[?47h"
 #define CSI_SCREEN_NORMAL "\x1b[?47l"
 #define CSI_CURSOR_HIDE_TOP_LEFT "\x1b[?25l\x1b[H"
+/* Pasted text comes between S_PASTE_BEGIN and S_PASTE_END */
+#define CSI_PASTE_ON "\x1b[?2004h"
+#define CSI_PASTE_OFF "\x1b[?2004l"
 
 #define SL(CSI) (CSI), (sizeof((CSI))-1)
 
@@ -70,6 +73,8 @@ typedef enum {
 	S_BACKSPACE,
 	S_DELETE,
 	S_ESCAPE,
+	S_PASTE_BEGIN,
+	S_PASTE_END,
 } special_type;
 
 typedef struct {
@@ -93,6 +98,8 @@ int move_cursor(int, int, int);
 
 input get_input(int);
 
+_Bool input_pending(int, suseconds_t);
+
 special_type which_key(char*);
 
 int raw(struct termios*, int);
@@ -21,6 +21,7 @@ SOFTWARE.
 */
 
 #include "utf8.h"
+#include "foldchars.h"
 
 int utf8_b2len(char* b)
 {
@@ -93,6 +94,45 @@ static _Bool cp_in(const int r[][2], size_t Z, int cp)
 	return 0;
 }
 
+/* Returns what cp maps to in sorted map m of Z+1 pairs */
+static int cp_map(const int m[][2], size_t Z, int cp)
+{
+	if (cp < m[0][0] || m[Z][0] < cp) return cp;
+	size_t A = 0, I;
+	while (A <= Z) {
+		I = (A+Z)/2;
+		if (cp < m[I][0]) {
+			Z = I-1;
+		}
+		else if (cp > m[I][0]) {
+			A = I+1;
+		}
+		else {
+			return m[I][1];
+		}
+	}
+	return cp;
+}
+
+/*
+ * Returns lower case of cp, without diacritics if marks.
+ * Then combining marks are -1, to be left out.
+ * What cp maps to never takes more bytes of UTF-8.
+ */
+int utf8_fold(int cp, _Bool marks)
+{
+	int b;
+
+	if (cp < 0x80) {
+		return 'A' <= cp && cp <= 'Z' ? cp | 0x20 : cp;
+	}
+	if (marks) {
+		if (cp_in(fold_marks, fold_marks_len-1, cp)) return -1;
+		if ((b = cp_map(fold_base, fold_base_len-1, cp)) != cp) return b;
+	}
+	return cp_map(fold_case, fold_case_len-1, cp);
+}
+
 int utf8_cp2w(int cp)
 {
 	if (cp < 0x20 || cp == 0x7f) return 0;
@@ -33,5 +33,6 @@ int utf8_dechar(int*, char*);
 int utf8_enchar(int, char*);
 int utf8_cp2w(int cp);
 int utf8_strwidth(char*);
+int utf8_fold(int, _Bool);
 
 #endif